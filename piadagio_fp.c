@@ -8,10 +8,6 @@
 //	http://cs.smith.edu/~nhowe/262/labs/kmodule.html
 //      https://github.com/vpcola/chip_i2c
 //
-// Todo:
-//	Convert from register_chrdev to cdev
-//	Dealloc client data!
-//
 ////////////////////////////////////////////////////////////////////
 #include <linux/kernel.h>
 #include <linux/init.h>
@@ -20,114 +16,252 @@
 #include <linux/jiffies.h>
 #include <linux/i2c.h>
 #include <linux/mutex.h>
+#include <linux/rwsem.h>
 #include <linux/err.h>
 #include <linux/sysfs.h>
 #include <linux/device.h>
 #include <linux/fs.h>
-//#include <linux/cdev.h>
+#include <linux/cdev.h>
+#include <linux/idr.h>
+#include <linux/pm.h>
+#include <linux/pm_runtime.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
 #include <linux/uaccess.h>
 #include <linux/workqueue.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/kfifo.h>
+#include <linux/leds.h>
+#include <linux/firmware.h>
+#include <linux/property.h>
+#include <linux/ctype.h>
 #include <linux/sched.h>
+#include <linux/atomic.h>
 #include "piadagio_fp.h"
+#include "piadagio_fp_lib.h"
 
 static bool fp_require_fsync = true;
 module_param(fp_require_fsync, bool, 0660);
 MODULE_PARM_DESC(fp_require_fsync, "Controls whether a fsync is required to update the front panel, after writing to screen buffer.\n");
 
+static bool fp_fsync_wait = false;
+module_param(fp_fsync_wait, bool, 0660);
+MODULE_PARM_DESC(fp_fsync_wait, "Controls whether fsync blocks until the committed frame has been displayed.\n");
+
+static unsigned int fp_frame_timeout = 2000;
+module_param(fp_frame_timeout, uint, 0660);
+MODULE_PARM_DESC(fp_frame_timeout, "Maximum time (ms) to wait for a frame to be displayed.\n");
+
+static unsigned int fp_max_fps = 25;
+module_param(fp_max_fps, uint, 0660);
+MODULE_PARM_DESC(fp_max_fps, "Default maximum frame rate (new frames per second), 0 is uncapped.\n");
+
+static unsigned int fp_idle_timeout = 60000;
+module_param(fp_idle_timeout, uint, 0660);
+MODULE_PARM_DESC(fp_idle_timeout, "Default inactivity time (ms) before a panel goes idle, 0 disables.\n");
+
+static bool fp_idle_blank = false;
+module_param(fp_idle_blank, bool, 0660);
+MODULE_PARM_DESC(fp_idle_blank, "Default for whether the display is blanked when a panel goes idle.\n");
+
+static unsigned int fp_idle_poll = 250;
+module_param(fp_idle_poll, uint, 0660);
+MODULE_PARM_DESC(fp_idle_poll, "Button poll interval (ms) while a panel is idle.\n");
+
+static char fp_glyph_bank[PIADAGIOFP_BANK_NAME_LEN] = "";
+module_param_string(fp_glyph_bank, fp_glyph_bank, sizeof(fp_glyph_bank), 0660);
+MODULE_PARM_DESC(fp_glyph_bank, "Default glyph bank (/lib/firmware/" PIADAGIOFP_BANK_PATH "<name>.bin), unless set by the 'glyph-bank' DT property.\n");
+
+static char fp_splash[PIADAGIOFP_SPLASH_LEN] = "";
+module_param_string(fp_splash, fp_splash, sizeof(fp_splash), 0660);
+MODULE_PARM_DESC(fp_splash, "Default splash text, shown as soon as a panel is probed (lines separated by '|'), unless set by the 'splash' DT property.\n");
+
+static char fp_splash_glyphs[(2 * GLYPH_BUFFER_LEN) + 1] = "";
+module_param_string(fp_splash_glyphs, fp_splash_glyphs, sizeof(fp_splash_glyphs), 0660);
+MODULE_PARM_DESC(fp_splash_glyphs, "Default splash glyphs (128 hex digits, 8 bytes per glyph), unless set by the 'splash-glyphs' DT property.\n");
+
+static unsigned int fp_button_debounce = 30;
+module_param(fp_button_debounce, uint, 0660);
+MODULE_PARM_DESC(fp_button_debounce, "Default time (ms) a button must be stable for, before a press/release is reported.\n");
+
+static unsigned int fp_button_long = 1000;
+module_param(fp_button_long, uint, 0660);
+MODULE_PARM_DESC(fp_button_long, "Default time (ms) a button must be held for a long press, 0 disables.\n");
+
+static unsigned int fp_button_repeat = 250;
+module_param(fp_button_repeat, uint, 0660);
+MODULE_PARM_DESC(fp_button_repeat, "Default repeat interval (ms) for a held button (after a long press), 0 disables.\n");
+
 ////////////////////////////////////////////////////////////////////
 // Global variables
 ////////////////////////////////////////////////////////////////////
-// Variables need by the character driver
-static struct i2c_client * piadagio_fp_i2c_client = NULL;
+// Module variables
+static struct class * piadagio_fp_class = NULL;
+static dev_t piadagio_fp_devt;						// First device number of our region
+static DEFINE_IDA(piadagio_fp_minors);					// Allocated minor numbers
+
+// Names used for the key=value statistics output
+static const char * const piadagio_fp_stat_names[PIADAGIOFP_STAT_MAX] = {
+	[PIADAGIOFP_STAT_UPDATE_LCD]		= "update_lcd",
+	[PIADAGIOFP_STAT_UPDATE_GLYPH]		= "update_glyph",
+	[PIADAGIOFP_STAT_UPDATE_LED]		= "update_led",
+	[PIADAGIOFP_STAT_BYTES_SENT]		= "bytes_sent",
+	[PIADAGIOFP_STAT_FRAMES_SKIPPED]	= "frames_skipped",
+	[PIADAGIOFP_STAT_FRAMES_SUBMITTED]	= "frames_submitted",
+	[PIADAGIOFP_STAT_FRAMES_DISPLAYED]	= "frames_displayed",
+	[PIADAGIOFP_STAT_FRAMES_SUPERSEDED]	= "frames_superseded",
+	[PIADAGIOFP_STAT_RETRIES_LCD]		= "retries_lcd",
+	[PIADAGIOFP_STAT_RETRIES_GLYPH]		= "retries_glyph",
+	[PIADAGIOFP_STAT_RETRIES_LED]		= "retries_led",
+	[PIADAGIOFP_STAT_ERRORS_STATUS]		= "errors_status",
+	[PIADAGIOFP_STAT_ERRORS_LCD]		= "errors_lcd",
+	[PIADAGIOFP_STAT_ERRORS_GLYPH]		= "errors_glyph",
+	[PIADAGIOFP_STAT_ERRORS_LED]		= "errors_led",
+	[PIADAGIOFP_STAT_BUS_NACK]		= "bus_nack",
+	[PIADAGIOFP_STAT_BUS_TIMEOUT]		= "bus_timeout",
+	[PIADAGIOFP_STAT_BUS_ARBITRATION]	= "bus_arbitration",
+	[PIADAGIOFP_STAT_BUS_SHORT]		= "bus_short",
+	[PIADAGIOFP_STAT_BUS_OTHER]		= "bus_other",
+	[PIADAGIOFP_STAT_EVENTS_DROPPED]	= "events_dropped",
+	[PIADAGIOFP_STAT_UPDATES_SUPPRESSED]	= "updates_suppressed",
+	[PIADAGIOFP_STAT_RESYNCS]		= "resyncs",
+};
 
-// We define a mutex so that only one process at a time can access our driver
-// at /dev. Any other process attempting to open this driver will return -EBUSY.
-static DEFINE_MUTEX(piadagio_fp_mutex);
+////////////////////////////////////////////////////////////////////
+// Statistics routines
+////////////////////////////////////////////////////////////////////
+static inline void piadagio_fp_stats_inc(struct piadagio_fp_data *data, enum piadagio_fp_stat stat) {
+	atomic64_inc(&data->stats[stat]);
+}
+
+static inline void piadagio_fp_stats_add(struct piadagio_fp_data *data, enum piadagio_fp_stat stat, s64 value) {
+	atomic64_add(value, &data->stats[stat]);
+}
 
-// Work queue variables
-static struct workqueue_struct *piadagio_fp_wq;
-static struct delayed_work piadagio_fp_wq_task_lcd;
-static DECLARE_DELAYED_WORK(piadagio_fp_wq_task_lcd, piadagio_fp_task_lcd_update);
-static struct delayed_work piadagio_fp_wq_task_led;
-static DECLARE_DELAYED_WORK(piadagio_fp_wq_task_led, piadagio_fp_task_led_update);
-static int piadagio_fp_wq_kill = 0;
+static inline s64 piadagio_fp_stats_get(struct piadagio_fp_data *data, enum piadagio_fp_stat stat) {
+	return atomic64_read(&data->stats[stat]);
+}
 
-// Module variables
-static struct class * piadagio_fp_class = NULL;
-static struct device * piadagio_fp_device = NULL;
-static int piadagio_fp_major;
-
-// Actual data storage
-static struct piadagio_fp_char_buffer piadagio_fp_buffer_lcd_screen;	// Buffer for the LCD screen
-static struct piadagio_fp_glyphs piadagio_fp_buffer_lcd_ugram;		// Buffer for the LCD UGRAM
-static char *piadagio_fp_buffer_index_ptr = 0;
-static unsigned char piadagio_fp_buffer_i2c_rw[I2C_BUFFER_LEN];		// Structure to r/w i2c data
-static unsigned char *piadagio_fp_glyph_index_ptr = 0;
-static unsigned char piadagio_fp_write_to_buffer = BUFFER_WRITE_CHAR;	// Which buffer to write to
-static unsigned int piadagio_fp_buffer_command = 0;			// Command read from the FP
-static unsigned long piadagio_fp_i2c_update_lcd_counter = 0;		// Update counter (LCD)
-static unsigned long piadagio_fp_i2c_update_glyph_counter = 0;		// Update counter (Glyph)
-static unsigned long piadagio_fp_i2c_update_led_counter = 0;		// Update counter (LED)
-static unsigned long piadagio_fp_i2c_update_errors_counter = 0;		// Update errors counter
-static unsigned long piadagio_fp_i2c_update_retries_counter = 0;	// Update retry counter
-static unsigned short piadagio_fp_i2c_update_do = 1;			// Controls whether an update actually happens (they're still scheduled)
-static unsigned short piadagio_fp_i2c_update_do_screen = 1;		// Controls whether a screen update actually happens
-static unsigned short piadagio_fp_led_online = 0;			// Online LED status
-static unsigned short piadagio_fp_led_power = 1;			// Power LED status
-static bool piadagio_fp_glyph_updated[8];				// Stores whether a LCD UGRAM glyph has been updated
-static bool piadagio_fp_i2c_update_screen_other_half = false;		// Used to store which half of the screen to update next
+// Zero all counters
+static void piadagio_fp_stats_reset(struct piadagio_fp_data *data) {
+	unsigned int i;
+
+	for (i = 0; i < PIADAGIOFP_STAT_MAX; i++) {
+		atomic64_set(&data->stats[i], 0);
+	}
+}
+
+// Classify the result of a failed/short i2c transfer
+// Also counts the run of errors, used to spot a panel reset.
+static void piadagio_fp_stats_bus_error(struct piadagio_fp_data *data, int retval) {
+	data->error_burst++;
+	switch (retval) {
+	case -ENXIO:
+	case -EREMOTEIO:
+		piadagio_fp_stats_inc(data, PIADAGIOFP_STAT_BUS_NACK);
+		break;
+	case -ETIMEDOUT:
+		piadagio_fp_stats_inc(data, PIADAGIOFP_STAT_BUS_TIMEOUT);
+		break;
+	case -EAGAIN:
+		piadagio_fp_stats_inc(data, PIADAGIOFP_STAT_BUS_ARBITRATION);
+		break;
+	default:
+		if (retval >= 0) {
+			piadagio_fp_stats_inc(data, PIADAGIOFP_STAT_BUS_SHORT);
+		} else {
+			piadagio_fp_stats_inc(data, PIADAGIOFP_STAT_BUS_OTHER);
+		}
+		break;
+	}
+}
 
 ////////////////////////////////////////////////////////////////////
 // General routines
 ////////////////////////////////////////////////////////////////////
 // Clears the character buffer with ASCII spaces
-void piadagio_fp_buffer_lcd_clear() {
+void piadagio_fp_buffer_lcd_clear(struct piadagio_fp_data *data) {
 	unsigned int i;
 	char *tmp_index;
 
 	printd("%s\n", __FUNCTION__);
 
-	tmp_index = piadagio_fp_buffer_lcd_screen.line1;
-	for (i = 0; i < (4 * LCD_LINE_LEN); i++) {
+	tmp_index = data->buffer_lcd_screen.chars;
+	for (i = 0; i < SCREEN_BUFFER_LEN; i++) {
 		*tmp_index = ' ';
 		tmp_index++;
 	}
+	memset(data->buffer_canvas, ' ', CANVAS_BUFFER_LEN);
 }
 
 // Initialise LCD UGRAM buffer
-void piadagio_fp_buffer_ugram_init() {
+void piadagio_fp_buffer_ugram_init(struct piadagio_fp_data *data) {
 	unsigned int i,j;
 
 	printd("%s\n", __FUNCTION__);
 
 	for (i = 0; i < 8; i++) {
 		for (j = 0; j < 8; j++) {
-//			piadagio_fp_buffer_lcd_ugram.glyph[i].pixel_line[j] = 0xff;
-			piadagio_fp_buffer_lcd_ugram.glyph[i].pixel_line[j] = j * 2;
+//			data->buffer_lcd_ugram.glyph[i].pixel_line[j] = 0xff;
+			data->buffer_lcd_ugram.glyph[i].pixel_line[j] = j * 2;
 		}
 
-		piadagio_fp_glyph_updated[i] = false;
+		data->glyph_updated[i] = false;
+	}
+}
+
+// Forget what the panel is showing (it may have been reset), so that
+// everything is checked against the buffers and resent.
+static void piadagio_fp_shadow_invalidate(struct piadagio_fp_data *data) {
+	unsigned int i;
+
+	data->shadow.screen_valid = 0;
+	data->shadow.cgram_valid = 0;
+	data->shadow.leds_valid = false;
+	for (i = 0; i < 8; i++) {
+		data->glyph_updated[i] = true;
 	}
+	piadagio_fp_frame_resync(data);
+	data->shadow_resync_last = jiffies;
 }
 
 // Reads the current status and command from the FP
 // A double read from the FP produces:
 //	1. FP status byte
 //	2. FP command byte
-int piadagio_fp_i2c_get_status() {
-	struct piadagio_fp_data *data = i2c_get_clientdata(piadagio_fp_i2c_client);
+int piadagio_fp_i2c_get_status(struct piadagio_fp_data *data) {
 	int bytes_recvd;
 
 	//printd("%s\n", __FUNCTION__);
 
 	mutex_lock(&data->update_lock);
-	bytes_recvd = i2c_master_recv(piadagio_fp_i2c_client, &piadagio_fp_buffer_i2c_rw[0], 2);
+	bytes_recvd = i2c_master_recv(data->client, &data->buffer_i2c_rw[0], 2);
 	mutex_unlock(&data->update_lock);
 	if (bytes_recvd == 2) {
-		piadagio_fp_buffer_command = piadagio_fp_buffer_i2c_rw[1];
-		return piadagio_fp_buffer_i2c_rw[0];
+		data->buffer_command = data->buffer_i2c_rw[1];
+		if (data->buffer_command != 0) {
+			data->command_last_read = jiffies;
+		}
+		// Back after a run of errors, the panel may have been reset
+		// (there's no reset flag in the status), so resend everything.
+		if (data->error_burst >= PIADAGIOFP_RESET_ERRORS) {
+			printi("%s: Panel back after %u errors, resyncing.\n", __FUNCTION__, data->error_burst);
+			piadagio_fp_shadow_invalidate(data);
+			piadagio_fp_stats_inc(data, PIADAGIOFP_STAT_RESYNCS);
+			if (!READ_ONCE(data->wq_kill)) {
+				mod_delayed_work(data->wq, &data->wq_task_led, 0);
+				if (!data->idle) {					// Otherwise resent when leaving idle
+					mod_delayed_work(data->wq, &data->wq_task_lcd, 0);
+				}
+			}
+		}
+		data->error_burst = 0;
+		piadagio_fp_buttons_update(data);
+		return data->buffer_i2c_rw[0];
 	}
 
+	piadagio_fp_stats_bus_error(data, bytes_recvd);
 	printe("%s: Failed to read FP status. Read %d bytes.\n", __FUNCTION__, bytes_recvd);
 	return -1;
 }
@@ -137,42 +271,24 @@ int piadagio_fp_i2c_get_status() {
 // the microcontroller, 2 updates are required. To further complicate
 // things, because of the memory layout of the LCD the lines are
 // written out in the order of 1 & 3, then 2 & 4.
-int piadagio_fp_i2c_update_screen() {
-	struct piadagio_fp_data *data = i2c_get_clientdata(piadagio_fp_i2c_client);
-	unsigned int bytes_2_send;
+int piadagio_fp_i2c_update_screen(struct piadagio_fp_data *data) {
+	int bytes_2_send;
 
 	//printd("%s\n", __FUNCTION__);
 
-	if (!piadagio_fp_i2c_update_screen_other_half) {
-		bytes_2_send = snprintf(&piadagio_fp_buffer_i2c_rw[0], I2C_BUFFER_LEN,
-					"%c%c%c%.*s%.*s",					// Format: length + cmd + position + lines
-					I2C_MSG_LEN_UPDATE_LCD - 1,				// Message length doesn't include this byte
-					I2C_MSG_TYPE_CHAR,					// Screen write cmd
-					0x0,							// Screen write position
-					LCD_LINE_LEN,piadagio_fp_buffer_lcd_screen.line1,
-					LCD_LINE_LEN,piadagio_fp_buffer_lcd_screen.line3);
-	} else {
-		bytes_2_send = snprintf(&piadagio_fp_buffer_i2c_rw[0], I2C_BUFFER_LEN,
-					"%c%c%c%.*s%.*s",					// Format: length + cmd + position + lines
-					I2C_MSG_LEN_UPDATE_LCD - 1,				// Message length doesn't include this byte
-					I2C_MSG_TYPE_CHAR,					// Screen write cmd
-					0x1,							// Screen write position
-					LCD_LINE_LEN,piadagio_fp_buffer_lcd_screen.line2,
-					LCD_LINE_LEN,piadagio_fp_buffer_lcd_screen.line4);
-	}
+	bytes_2_send = piadagio_fp_encode_screen(&data->geometry, &data->buffer_i2c_rw[0], &data->buffer_lcd_screen,
+						data->i2c_update_screen_other_half);
 	if (bytes_2_send == I2C_MSG_LEN_UPDATE_LCD) {
 		mutex_lock(&data->update_lock);
-		bytes_2_send = i2c_master_send(piadagio_fp_i2c_client, &piadagio_fp_buffer_i2c_rw[0], I2C_MSG_LEN_UPDATE_LCD);
+		bytes_2_send = i2c_master_send(data->client, &data->buffer_i2c_rw[0], I2C_MSG_LEN_UPDATE_LCD);
 		mutex_unlock(&data->update_lock);
 		if (bytes_2_send == I2C_MSG_LEN_UPDATE_LCD) {
 			//printd("%s: Updated screen.\n", __FUNCTION__);
-			if (piadagio_fp_i2c_update_screen_other_half) {
-				piadagio_fp_i2c_update_screen_other_half = false;
-			} else {
-				piadagio_fp_i2c_update_screen_other_half = true;
-			}
+			piadagio_fp_shadow_store_screen(&data->geometry, &data->shadow, &data->buffer_i2c_rw[0]);
+			piadagio_fp_stats_add(data, PIADAGIOFP_STAT_BYTES_SENT, bytes_2_send);
 			return 0;
 		} else {
+			piadagio_fp_stats_bus_error(data, bytes_2_send);
 			printe("%s: Failed to write screen update.\n", __FUNCTION__);
 			return -1;
 		}
@@ -183,34 +299,25 @@ int piadagio_fp_i2c_update_screen() {
 }
 
 // Updates a CGRAM glyph
-int piadagio_fp_i2c_update_glyph(unsigned char glyph_index) {
-	struct piadagio_fp_data *data = i2c_get_clientdata(piadagio_fp_i2c_client);
-	unsigned int bytes_2_send;
-	unsigned char tmp_i2c_buffer[I2C_MSG_LEN_UPDATE_CGRAM + 1];
+int piadagio_fp_i2c_update_glyph(struct piadagio_fp_data *data, unsigned char glyph_index) {
+	int bytes_2_send;
+	unsigned char tmp_i2c_buffer[I2C_MSG_LEN_UPDATE_CGRAM];
 
 	//printd("%s\n", __FUNCTION__);
 
-	bytes_2_send = snprintf(&tmp_i2c_buffer[0], (I2C_MSG_LEN_UPDATE_CGRAM + 1),	// Buffer size includes null character from sprintf
-				"%c%c%c%c%c%c%c%c%c%c%c",				// Format: length + cmd + glyph index + glyph bytes[8]
-				I2C_MSG_LEN_UPDATE_CGRAM - 1,				// Message length, not including this byte
-				I2C_MSG_TYPE_GLYPH,					// Glyph update cmd
-				glyph_index,
-				piadagio_fp_buffer_lcd_ugram.glyph[glyph_index].pixel_line[0],
-				piadagio_fp_buffer_lcd_ugram.glyph[glyph_index].pixel_line[1],
-				piadagio_fp_buffer_lcd_ugram.glyph[glyph_index].pixel_line[2],
-				piadagio_fp_buffer_lcd_ugram.glyph[glyph_index].pixel_line[3],
-				piadagio_fp_buffer_lcd_ugram.glyph[glyph_index].pixel_line[4],
-				piadagio_fp_buffer_lcd_ugram.glyph[glyph_index].pixel_line[5],
-				piadagio_fp_buffer_lcd_ugram.glyph[glyph_index].pixel_line[6],
-				piadagio_fp_buffer_lcd_ugram.glyph[glyph_index].pixel_line[7]);
+	bytes_2_send = piadagio_fp_encode_glyph(&tmp_i2c_buffer[0], glyph_index, &data->buffer_lcd_ugram.glyph[glyph_index]);
 	if (bytes_2_send == I2C_MSG_LEN_UPDATE_CGRAM) {
 		mutex_lock(&data->update_lock);
-		bytes_2_send = i2c_master_send(piadagio_fp_i2c_client, &tmp_i2c_buffer[0], I2C_MSG_LEN_UPDATE_CGRAM);
+		bytes_2_send = i2c_master_send(data->client, &tmp_i2c_buffer[0], I2C_MSG_LEN_UPDATE_CGRAM);
 		mutex_unlock(&data->update_lock);
 		if (bytes_2_send == I2C_MSG_LEN_UPDATE_CGRAM) {
 			//printd("%s: Updated glyph.\n", __FUNCTION__);
+			memcpy(data->shadow.cgram.glyph[glyph_index].pixel_line, &tmp_i2c_buffer[3], 8);
+			data->shadow.cgram_valid |= (1 << glyph_index);
+			piadagio_fp_stats_add(data, PIADAGIOFP_STAT_BYTES_SENT, bytes_2_send);
 			return 0;
 		} else {
+			piadagio_fp_stats_bus_error(data, bytes_2_send);
 			printe("%s: Failed to write glyph update.\n", __FUNCTION__);
 			return -1;
 		}
@@ -220,34 +327,49 @@ int piadagio_fp_i2c_update_glyph(unsigned char glyph_index) {
 	return -1;
 }
 
-// Updates the state of the FP LEDs
-int piadagio_fp_i2c_update_leds() {
-	struct piadagio_fp_data *data = i2c_get_clientdata(piadagio_fp_i2c_client);
-	unsigned int bytes_2_send;
-	char tmp_i2c_buffer[I2C_MSG_LEN_UPDATE_LED + 1], tmp_led_status = 0;
+// Clears the screen (used to blank the display)
+int piadagio_fp_i2c_clear(struct piadagio_fp_data *data) {
+	int bytes_2_send;
+	unsigned char tmp_i2c_buffer[I2C_MSG_LEN_CLEAR];
 
 	//printd("%s\n", __FUNCTION__);
 
-	if (piadagio_fp_led_online > 0) {
-		tmp_led_status = tmp_led_status | 2;
-	}
-	if (piadagio_fp_led_power > 0) {
-		tmp_led_status = tmp_led_status | 1;
+	bytes_2_send = piadagio_fp_encode_clear(&tmp_i2c_buffer[0]);
+	mutex_lock(&data->update_lock);
+	bytes_2_send = i2c_master_send(data->client, &tmp_i2c_buffer[0], bytes_2_send);
+	mutex_unlock(&data->update_lock);
+	if (bytes_2_send == I2C_MSG_LEN_CLEAR) {
+		memset(data->shadow.screen.chars, ' ', SCREEN_BUFFER_LEN);	// Cleared to spaces
+		data->shadow.screen_valid = PIADAGIOFP_SCREEN_HALVES;
+		piadagio_fp_stats_add(data, PIADAGIOFP_STAT_BYTES_SENT, bytes_2_send);
+		return 0;
 	}
 
-	bytes_2_send = snprintf(&tmp_i2c_buffer[0], (I2C_MSG_LEN_UPDATE_LED + 1),	// Buffer size includes null character from sprintf
-				"%c%c%c",						// Format: length + cmd + led status
-				I2C_MSG_LEN_UPDATE_LED - 1,				// Message length, not including this byte
-				I2C_MSG_TYPE_LED,					// LED update cmd
-				tmp_led_status);					// LED status bits
+	piadagio_fp_stats_bus_error(data, bytes_2_send);
+	printe("%s: Failed to write clear.\n", __FUNCTION__);
+	return -1;
+}
+
+// Updates the state of the FP LEDs
+int piadagio_fp_i2c_update_leds(struct piadagio_fp_data *data) {
+	int bytes_2_send;
+	unsigned char tmp_i2c_buffer[I2C_MSG_LEN_UPDATE_LED];
+
+	//printd("%s\n", __FUNCTION__);
+
+	bytes_2_send = piadagio_fp_encode_leds(&tmp_i2c_buffer[0], data->led_online, data->led_power);
 	if (bytes_2_send == I2C_MSG_LEN_UPDATE_LED) {
 		mutex_lock(&data->update_lock);
-		bytes_2_send = i2c_master_send(piadagio_fp_i2c_client, &tmp_i2c_buffer[0], I2C_MSG_LEN_UPDATE_LED);
+		bytes_2_send = i2c_master_send(data->client, &tmp_i2c_buffer[0], I2C_MSG_LEN_UPDATE_LED);
 		mutex_unlock(&data->update_lock);
 		if (bytes_2_send == I2C_MSG_LEN_UPDATE_LED) {
 			//printd("%s: Updated LEDs.\n", __FUNCTION__);
+			data->shadow.leds = tmp_i2c_buffer[2];
+			data->shadow.leds_valid = true;
+			piadagio_fp_stats_add(data, PIADAGIOFP_STAT_BYTES_SENT, bytes_2_send);
 			return 0;
 		} else {
+			piadagio_fp_stats_bus_error(data, bytes_2_send);
 			printe("%s: Failed to write LED update.\n", __FUNCTION__);
 			return -1;
 		}
@@ -257,30 +379,777 @@ int piadagio_fp_i2c_update_leds() {
 	return -1;
 }
 
+/////////////////////////////////////////////////////////////////////
+// Idle routines
+/////////////////////////////////////////////////////////////////////
+// Take a runtime PM reference for a bus transfer, from the tasks that
+// also run while idle (when the panel's own reference is dropped). This
+// resumes the device, and so its bus, if it was suspended.
+// Returns 0 on success, or the error from resuming.
+static int piadagio_fp_pm_get(struct piadagio_fp_data *data) {
+	int retval;
+
+	retval = pm_runtime_get_sync(&data->client->dev);
+	if (retval < 0) {
+		pm_runtime_put_noidle(&data->client->dev);
+		return retval;
+	}
+	return 0;
+}
+
+// Drop the reference taken by piadagio_fp_pm_get
+static void piadagio_fp_pm_put(struct piadagio_fp_data *data) {
+	pm_runtime_mark_last_busy(&data->client->dev);
+	pm_runtime_put_autosuspend(&data->client->dev);
+}
+
+// Checks whether there has been no activity (commits or button presses)
+// for longer than the idle timeout
+static bool piadagio_fp_idle_check(struct piadagio_fp_data *data) {
+	unsigned long tmp_last_activity = data->lcd_last_updated;
+
+	if ((data->idle_timeout == 0) || data->idle) {
+		return false;
+	}
+	if (time_after(data->command_last_read, tmp_last_activity)) {
+		tmp_last_activity = data->command_last_read;
+	}
+	return time_after(jiffies, tmp_last_activity + msecs_to_jiffies(data->idle_timeout));
+}
+
+// Stop the periodic screen/LED updates, and drop to a slow button poll
+static void piadagio_fp_idle_enter(struct piadagio_fp_data *data) {
+	int fp_status;
+
+	mutex_lock(&data->idle_lock);
+	if (!data->idle) {
+		printd("%s\n", __FUNCTION__);
+		data->idle = true;
+
+		if (data->idle_blank) {
+			fp_status = piadagio_fp_i2c_get_status(data);
+			if ((fp_status >= 0) && (fp_status < I2C_FP_STATUS_BUSY)) {
+				piadagio_fp_i2c_clear(data);
+			}
+		}
+
+		if (!READ_ONCE(data->wq_kill)) {
+			queue_delayed_work(data->wq, &data->wq_task_idle, msecs_to_jiffies(fp_idle_poll));
+		}
+		piadagio_fp_pm_put(data);					// Drop the reference held while active
+	}
+	mutex_unlock(&data->idle_lock);
+}
+
+// Return to full speed updates
+static void piadagio_fp_idle_exit(struct piadagio_fp_data *data) {
+	mutex_lock(&data->idle_lock);
+	if (data->idle) {
+		printd("%s\n", __FUNCTION__);
+		pm_runtime_get_sync(&data->client->dev);
+		data->idle = false;
+		data->lcd_last_updated = jiffies;				// Don't immediately go idle again
+		piadagio_fp_frame_resync(data);					// Resend whatever differs from the panel
+
+		if (!READ_ONCE(data->wq_kill)) {
+			mod_delayed_work(data->wq, &data->wq_task_lcd, 0);
+			mod_delayed_work(data->wq, &data->wq_task_led, 0);
+		}
+	}
+	mutex_unlock(&data->idle_lock);
+}
+
+// Note activity from userspace, waking the panel if needed
+static void piadagio_fp_activity(struct piadagio_fp_data *data) {
+	data->lcd_last_updated = jiffies;
+	if (READ_ONCE(data->idle)) {
+		piadagio_fp_idle_exit(data);
+	}
+}
+
+/////////////////////////////////////////////////////////////////////
+// Frame routines
+/////////////////////////////////////////////////////////////////////
+// Queue a new frame, the halves sent are worked out (from the shadow)
+// when the frame is started.
+// Returns the frame's sequence number.
+static u32 piadagio_fp_frame_queue(struct piadagio_fp_data *data) {
+	u32 tmp_seq;
+
+	spin_lock_bh(&data->frame_lock);
+	tmp_seq = data->frame_commit_seq + 1;
+	WRITE_ONCE(data->frame_commit_seq, tmp_seq);
+	spin_unlock_bh(&data->frame_lock);
+	data->i2c_update_do_screen = 1;
+	piadagio_fp_stats_inc(data, PIADAGIOFP_STAT_FRAMES_SUBMITTED);
+
+	piadagio_fp_activity(data);
+	if (!READ_ONCE(data->wq_kill)) {
+		mod_delayed_work(data->wq, &data->wq_task_lcd, 0);		// Start the frame as soon as allowed
+	}
+	return tmp_seq;
+}
+
+// Hold screen updates until the next commit (fsync), the frame is
+// counted as skipped once, when the hold starts.
+static void piadagio_fp_frame_hold_for_fsync(struct piadagio_fp_data *data) {
+	if (data->i2c_update_do_screen > 0) {
+		piadagio_fp_stats_inc(data, PIADAGIOFP_STAT_FRAMES_SKIPPED);
+	}
+	data->i2c_update_do_screen = 0;
+}
+
+// Commit the screen buffer as a new frame (from userspace)
+// This stops any animation that is playing. When showing the canvas,
+// the viewport is projected onto the screen first.
+// Returns the frame's sequence number.
+static u32 piadagio_fp_frame_commit(struct piadagio_fp_data *data) {
+	piadagio_fp_anim_stop(data);
+	if (data->canvas_active) {
+		piadagio_fp_canvas_project(&data->geometry, &data->buffer_lcd_screen, data->buffer_canvas, data->canvas_viewport);
+	}
+	return piadagio_fp_frame_queue(data);
+}
+
+// Move the viewport on the canvas, and show the canvas on the screen
+// Only sends a frame if the screen has changed.
+static int piadagio_fp_frame_set_viewport(struct piadagio_fp_data *data, unsigned int viewport) {
+	u8 tmp_halves;
+
+	if (viewport > piadagio_fp_canvas_viewport_max(&data->geometry)) {
+		return -EINVAL;
+	}
+
+	piadagio_fp_anim_stop(data);
+	data->canvas_viewport = viewport;
+	data->canvas_active = true;
+	tmp_halves = piadagio_fp_canvas_project(&data->geometry, &data->buffer_lcd_screen, data->buffer_canvas, viewport);
+	if (tmp_halves) {
+		piadagio_fp_frame_queue(data);
+	}
+	return 0;
+}
+
+// Abandon any frame in flight, the next frame sends whatever differs
+// from the panel
+static void piadagio_fp_frame_resync(struct piadagio_fp_data *data) {
+	data->frame_halves = 0;
+	data->i2c_update_screen_other_half = false;
+}
+
+// Returns how long (in jiffies) until the next frame can be started
+// New frames are capped by the frame rate, refreshes of an unchanged
+// buffer are sent at a slower rate. A frame in flight isn't held.
+static unsigned long piadagio_fp_frame_hold(struct piadagio_fp_data *data) {
+	unsigned long tmp_next;
+
+	if (data->frame_halves != 0) {
+		return 0;
+	}
+
+	if (READ_ONCE(data->frame_commit_seq) != data->frame_sending_seq) {
+		tmp_next = data->frame_last_start + data->frame_interval;
+	} else {
+		tmp_next = data->frame_last_start + max_t(unsigned long, data->frame_interval, PIADAGIOFP_REFRESH_DELAY);
+	}
+	if (time_before(jiffies, tmp_next)) {
+		return tmp_next - jiffies;
+	}
+	return 0;
+}
+
+// Start sending a frame, any commits since the last frame was started
+// have been merged into this one. Only the halves that differ from what
+// the panel has acknowledged are sent, so a refresh of an unchanged
+// buffer sends nothing (frame_halves is left as 0).
+static void piadagio_fp_frame_start(struct piadagio_fp_data *data) {
+	u32 tmp_seq;
+
+	spin_lock_bh(&data->frame_lock);
+	tmp_seq = data->frame_commit_seq;
+	spin_unlock_bh(&data->frame_lock);
+
+	data->frame_halves = piadagio_fp_shadow_screen_diff(&data->geometry, &data->shadow, &data->buffer_lcd_screen);
+	if (tmp_seq != data->frame_sending_seq) {				// Only a commit counts, not a refresh
+		piadagio_fp_stats_add(data, PIADAGIOFP_STAT_UPDATES_SUPPRESSED, hweight8(PIADAGIOFP_SCREEN_HALVES & ~data->frame_halves));
+	}
+	data->i2c_update_screen_other_half = !(data->frame_halves & PIADAGIOFP_SCREEN_HALF_1);
+
+	if (tmp_seq != data->frame_sending_seq) {
+		piadagio_fp_stats_add(data, PIADAGIOFP_STAT_FRAMES_SUPERSEDED, (u32) (tmp_seq - data->frame_sending_seq - 1));
+		data->frame_sending_seq = tmp_seq;
+	}
+	data->frame_last_start = jiffies;
+}
+
+// Both halves of the frame being sent have been acknowledged
+static void piadagio_fp_frame_displayed(struct piadagio_fp_data *data) {
+	if (data->frame_sending_seq != data->frame_displayed_seq) {
+		piadagio_fp_stats_inc(data, PIADAGIOFP_STAT_FRAMES_DISPLAYED);
+	}
+	WRITE_ONCE(data->frame_displayed_seq, data->frame_sending_seq);
+	wake_up_interruptible_all(&data->frame_wait);
+}
+
+// Sets the maximum frame rate
+static void piadagio_fp_frame_set_max_fps(struct piadagio_fp_data *data, unsigned int max_fps) {
+	data->frame_max_fps = max_fps;
+	if (max_fps > 0) {
+		data->frame_interval = msecs_to_jiffies(1000 / max_fps);
+	} else {
+		data->frame_interval = 0;
+	}
+}
+
+// Checks whether a frame has been displayed
+static inline bool piadagio_fp_frame_is_displayed(struct piadagio_fp_data *data, u32 seq) {
+	return piadagio_fp_seq_after_eq(READ_ONCE(data->frame_displayed_seq), seq);
+}
+
+// Block until a frame has been displayed
+static int piadagio_fp_frame_wait(struct piadagio_fp_data *data, u32 seq) {
+	long retval;
+
+	retval = wait_event_interruptible_timeout(data->frame_wait,
+			(piadagio_fp_frame_is_displayed(data, seq) || READ_ONCE(data->wq_kill)),
+			msecs_to_jiffies(fp_frame_timeout));
+	if (retval < 0) {
+		return retval;
+	} else if (retval == 0) {
+		return -ETIMEDOUT;
+	} else if (!piadagio_fp_frame_is_displayed(data, seq)) {
+		return -ENODEV;
+	}
+	return 0;
+}
+
+/////////////////////////////////////////////////////////////////////
+// Animation routines
+/////////////////////////////////////////////////////////////////////
+// The next keyframe is due, the work is done in the panel's workqueue
+// (as it has to sleep on the i2c bus).
+static enum hrtimer_restart piadagio_fp_anim_timer(struct hrtimer *timer) {
+	struct piadagio_fp_data *data = container_of(timer, struct piadagio_fp_data, anim_timer);
+
+	queue_work(data->wq, &data->anim_work);
+	return HRTIMER_NORESTART;
+}
+
+// Start playing a sequence of keyframes (from userspace)
+static int piadagio_fp_anim_start(struct piadagio_fp_data *data, const struct piadagio_fp_animation *anim) {
+	struct piadagio_fp_keyframe *tmp_frames;
+	unsigned int i;
+
+	if ((anim->count == 0) || (anim->count > PIADAGIOFP_ANIM_MAX_FRAMES)) {
+		return -EINVAL;
+	}
+
+	tmp_frames = vmemdup_user(u64_to_user_ptr(anim->keyframes), anim->count * sizeof(struct piadagio_fp_keyframe));
+	if (IS_ERR(tmp_frames)) {
+		return PTR_ERR(tmp_frames);
+	}
+	for (i = 0; i < anim->count; i++) {
+		if ((tmp_frames[i].duration_ms == 0) ||
+				(tmp_frames[i].flags & ~(PIADAGIOFP_KEYFRAME_SCREEN | PIADAGIOFP_KEYFRAME_GLYPHS))) {
+			kvfree(tmp_frames);
+			return -EINVAL;
+		}
+	}
+
+	piadagio_fp_anim_stop(data);
+
+	mutex_lock(&data->anim_lock);
+	data->anim_frames = tmp_frames;
+	data->anim_count = anim->count;
+	data->anim_index = 0;
+	data->anim_loops = anim->loops;
+	data->anim_next = ktime_get();
+	mutex_unlock(&data->anim_lock);
+
+	if (!READ_ONCE(data->wq_kill)) {
+		queue_work(data->wq, &data->anim_work);				// First keyframe is displayed immediately
+	}
+	return 0;
+}
+
+// Stop any animation that is playing
+// The last keyframe applied is left on the display.
+static void piadagio_fp_anim_stop(struct piadagio_fp_data *data) {
+	struct piadagio_fp_keyframe *tmp_frames;
+
+	mutex_lock(&data->anim_lock);
+	tmp_frames = data->anim_frames;
+	data->anim_frames = NULL;					// Stops the task rearming the timer
+	mutex_unlock(&data->anim_lock);
+
+	if (tmp_frames == NULL) {
+		return;
+	}
+	hrtimer_cancel(&data->anim_timer);
+	cancel_work_sync(&data->anim_work);
+	kvfree(tmp_frames);
+}
+
+/////////////////////////////////////////////////////////////////////
+// Event routines
+/////////////////////////////////////////////////////////////////////
+// Queue an event for userspace
+// Only called from the panel's workqueue, so there is a single producer.
+static void piadagio_fp_event_push(struct piadagio_fp_data *data, u16 type, u16 code, u32 value) {
+	struct piadagio_fp_event tmp_event = {
+		.type = type,
+		.code = code,
+		.value = value,
+	};
+
+	if (!kfifo_put(&data->events, tmp_event)) {
+		piadagio_fp_stats_inc(data, PIADAGIOFP_STAT_EVENTS_DROPPED);
+		return;
+	}
+	wake_up_interruptible(&data->event_wait);
+}
+
+/////////////////////////////////////////////////////////////////////
+// Button routines
+/////////////////////////////////////////////////////////////////////
+// Handle the command read with the FP status
+// Steps the button state machine, queueing any event for userspace
+// (in event mode). Presses, and repeats of up/down, are passed to the
+// menu. The menu is handled by it's own task, as this is called with
+// locks held by the other tasks. While a button is down, the buttons
+// are polled at the rate needed to catch the next transition.
+static void piadagio_fp_buttons_update(struct piadagio_fp_data *data) {
+	s64 tmp_now = ktime_to_ms(ktime_get());
+	s64 tmp_next;
+	u16 tmp_type, tmp_code = 0;
+	u32 tmp_value = 0;
+
+	tmp_type = piadagio_fp_button_step(&data->button, data->buffer_command, tmp_now, &tmp_code, &tmp_value);
+	if (tmp_type != 0) {
+		if (data->read_mode == PIADAGIOFP_READ_EVENTS) {
+			piadagio_fp_event_push(data, tmp_type, tmp_code, tmp_value);
+		}
+
+		if ((READ_ONCE(data->menu_items) != NULL) && ((tmp_type == PIADAGIOFP_EVENT_PRESS) ||
+				((tmp_type == PIADAGIOFP_EVENT_REPEAT) &&
+				((tmp_code == data->menu_key[PIADAGIOFP_MENU_KEY_UP]) || (tmp_code == data->menu_key[PIADAGIOFP_MENU_KEY_DOWN]))))) {
+			kfifo_put(&data->menu_keys, (u8) tmp_code);
+			if (!READ_ONCE(data->wq_kill)) {
+				queue_work(data->wq, &data->menu_work);
+			}
+		}
+	}
+
+	tmp_next = piadagio_fp_button_next(&data->button, tmp_now, PIADAGIOFP_BUTTON_POLL);
+	if ((tmp_next >= 0) && (!READ_ONCE(data->wq_kill))) {
+		mod_delayed_work(data->wq, &data->wq_task_buttons, msecs_to_jiffies(tmp_next));
+	}
+}
+
+/////////////////////////////////////////////////////////////////////
+// Menu routines
+/////////////////////////////////////////////////////////////////////
+// Find the items on a level of the menu
+// Returns the number of items, their indexes are stored in level.
+static unsigned int piadagio_fp_menu_level(struct piadagio_fp_data *data, u16 parent, u16 *level) {
+	unsigned int i, tmp_count = 0;
+
+	for (i = 0; i < data->menu_count; i++) {
+		if (data->menu_items[i].parent == parent) {
+			level[tmp_count++] = i;
+		}
+	}
+	return tmp_count;
+}
+
+// Draw the current level of the menu into the screen buffer
+// The highlighted item is marked with '>', and only the screen halves
+// that changed are sent.
+static void piadagio_fp_menu_render(struct piadagio_fp_data *data) {
+	struct piadagio_fp_char_buffer tmp_screen;
+	u16 tmp_level[PIADAGIOFP_MENU_MAX_ITEMS];
+	unsigned int tmp_count, i, j;
+	const char *tmp_label;
+	char *tmp_line;
+	u8 tmp_halves;
+
+	tmp_count = piadagio_fp_menu_level(data, data->menu_parent, tmp_level);
+
+	// Scroll to keep the highlighted item visible
+	if (data->menu_pos < data->menu_top) {
+		data->menu_top = data->menu_pos;
+	} else if (data->menu_pos >= (data->menu_top + data->geometry.rows)) {
+		data->menu_top = data->menu_pos - (data->geometry.rows - 1);
+	}
+
+	memset(&tmp_screen, ' ', sizeof(tmp_screen));
+	for (i = 0; (i < data->geometry.rows) && ((data->menu_top + i) < tmp_count); i++) {
+		tmp_line = tmp_screen.chars + (i * data->geometry.cols);
+		if ((data->menu_top + i) == data->menu_pos) {
+			tmp_line[0] = '>';
+		}
+		tmp_label = data->menu_items[tmp_level[data->menu_top + i]].label;
+		for (j = 0; (j < (data->geometry.cols - 1)) && (j < PIADAGIOFP_MENU_LABEL_LEN) && (tmp_label[j] != 0); j++) {
+			tmp_line[j + 1] = tmp_label[j];
+		}
+	}
+
+	tmp_halves = piadagio_fp_screen_diff(&data->geometry, &data->buffer_lcd_screen, (unsigned char *) tmp_screen.chars);
+	if (tmp_halves) {
+		memcpy(data->buffer_lcd_screen.chars, tmp_screen.chars, SCREEN_BUFFER_LEN);
+		piadagio_fp_frame_queue(data);
+	}
+}
+
+// Move around the menu in response to a key press
+static void piadagio_fp_menu_key(struct piadagio_fp_data *data, u8 key) {
+	u16 tmp_level[PIADAGIOFP_MENU_MAX_ITEMS];
+	unsigned int tmp_count, i;
+	u16 tmp_item;
+
+	tmp_count = piadagio_fp_menu_level(data, data->menu_parent, tmp_level);
+	if (tmp_count == 0) {
+		return;
+	}
+
+	if (key == data->menu_key[PIADAGIOFP_MENU_KEY_UP]) {
+		if (data->menu_pos > 0) {
+			data->menu_pos--;
+		}
+	} else if (key == data->menu_key[PIADAGIOFP_MENU_KEY_DOWN]) {
+		if ((data->menu_pos + 1) < tmp_count) {
+			data->menu_pos++;
+		}
+	} else if (key == data->menu_key[PIADAGIOFP_MENU_KEY_SELECT]) {
+		tmp_item = tmp_level[data->menu_pos];
+		if (piadagio_fp_menu_level(data, tmp_item, tmp_level) > 0) {	// Descend into the sub menu
+			data->menu_parent = tmp_item;
+			data->menu_pos = 0;
+			data->menu_top = 0;
+		} else {							// Leaf, so tell userspace
+			piadagio_fp_event_push(data, PIADAGIOFP_EVENT_ACTION, data->menu_items[tmp_item].action, tmp_item);
+		}
+	} else if (key == data->menu_key[PIADAGIOFP_MENU_KEY_BACK]) {
+		if (data->menu_parent != PIADAGIOFP_MENU_ROOT) {		// Back up a level, highlighting where we came from
+			tmp_item = data->menu_parent;
+			data->menu_parent = data->menu_items[tmp_item].parent;
+			tmp_count = piadagio_fp_menu_level(data, data->menu_parent, tmp_level);
+			for (i = 0; i < tmp_count; i++) {
+				if (tmp_level[i] == tmp_item) {
+					data->menu_pos = i;
+					break;
+				}
+			}
+			data->menu_top = 0;
+		}
+	} else {
+		return;
+	}
+
+	piadagio_fp_menu_render(data);
+}
+
+// Start a menu (from userspace)
+static int piadagio_fp_menu_start(struct piadagio_fp_data *data, const struct piadagio_fp_menu *menu) {
+	struct piadagio_fp_menu_item *tmp_items, *tmp_old;
+	unsigned int i;
+
+	if ((menu->count == 0) || (menu->count > PIADAGIOFP_MENU_MAX_ITEMS)) {
+		return -EINVAL;
+	}
+
+	tmp_items = vmemdup_user(u64_to_user_ptr(menu->items), menu->count * sizeof(struct piadagio_fp_menu_item));
+	if (IS_ERR(tmp_items)) {
+		return PTR_ERR(tmp_items);
+	}
+	for (i = 0; i < menu->count; i++) {				// Parents must come first (so there are no loops)
+		if ((tmp_items[i].parent != PIADAGIOFP_MENU_ROOT) && (tmp_items[i].parent >= i)) {
+			kvfree(tmp_items);
+			return -EINVAL;
+		}
+	}
+
+	piadagio_fp_anim_stop(data);
+
+	mutex_lock(&data->menu_lock);
+	tmp_old = data->menu_items;
+	data->menu_count = menu->count;
+	data->menu_key[PIADAGIOFP_MENU_KEY_UP] = menu->key_up;
+	data->menu_key[PIADAGIOFP_MENU_KEY_DOWN] = menu->key_down;
+	data->menu_key[PIADAGIOFP_MENU_KEY_SELECT] = menu->key_select;
+	data->menu_key[PIADAGIOFP_MENU_KEY_BACK] = menu->key_back;
+	data->menu_parent = PIADAGIOFP_MENU_ROOT;
+	data->menu_pos = 0;
+	data->menu_top = 0;
+	WRITE_ONCE(data->menu_items, tmp_items);
+	data->canvas_active = false;
+	piadagio_fp_menu_render(data);
+	mutex_unlock(&data->menu_lock);
+
+	kvfree(tmp_old);
+	return 0;
+}
+
+// Stop the menu, the screen is left as it was
+static void piadagio_fp_menu_stop(struct piadagio_fp_data *data) {
+	struct piadagio_fp_menu_item *tmp_old;
+
+	mutex_lock(&data->menu_lock);
+	tmp_old = data->menu_items;
+	WRITE_ONCE(data->menu_items, NULL);
+	mutex_unlock(&data->menu_lock);
+
+	kvfree(tmp_old);
+}
+
+/////////////////////////////////////////////////////////////////////
+// Big text routines
+/////////////////////////////////////////////////////////////////////
+// Draw a string in big text, from the given line/column
+// The segment glyphs are loaded (only those not already resident), and
+// only the screen halves that change are sent.
+static int piadagio_fp_big_text(struct piadagio_fp_data *data, unsigned int row, unsigned int col, const char *text, size_t len) {
+	struct piadagio_fp_char_buffer tmp_screen;
+	char *tmp_top, *tmp_bottom;
+	int tmp_width;
+	u8 tmp_halves;
+
+	tmp_width = piadagio_fp_big_width(text, len);
+	// Checked without adding to row/col, as they come from userspace
+	if ((row >= data->geometry.rows) || ((data->geometry.rows - row) < 2) ||
+		(col >= data->geometry.cols) || (tmp_width < 0) ||
+		((unsigned int) tmp_width > (data->geometry.cols - col + 1))) {	// The last gap can fall off the end
+		return -EINVAL;
+	}
+
+	piadagio_fp_anim_stop(data);
+	data->canvas_active = false;
+
+	if (piadagio_fp_glyph_update(&data->buffer_lcd_ugram, data->glyph_updated, piadagio_fp_big_glyphs)) {
+		piadagio_fp_activity(data);
+		if (!READ_ONCE(data->wq_kill)) {
+			mod_delayed_work(data->wq, &data->wq_task_lcd, 0);
+		}
+	}
+
+	memcpy(&tmp_screen, &data->buffer_lcd_screen, SCREEN_BUFFER_LEN);
+	tmp_top = tmp_screen.chars + (row * data->geometry.cols) + col;
+	tmp_bottom = tmp_top + data->geometry.cols;
+	memset(tmp_top, ' ', (data->geometry.cols - col));
+	memset(tmp_bottom, ' ', (data->geometry.cols - col));
+	piadagio_fp_big_render(tmp_top, tmp_bottom, text, len);
+
+	tmp_halves = piadagio_fp_screen_diff(&data->geometry, &data->buffer_lcd_screen, (unsigned char *) tmp_screen.chars);
+	if (tmp_halves) {
+		memcpy(data->buffer_lcd_screen.chars, tmp_screen.chars, SCREEN_BUFFER_LEN);
+		piadagio_fp_frame_queue(data);
+	}
+	return 0;
+}
+
+/////////////////////////////////////////////////////////////////////
+// Glyph bank routines
+/////////////////////////////////////////////////////////////////////
+// An outstanding glyph bank request
+struct piadagio_fp_bank_request {
+	struct piadagio_fp_data *data;
+	u32 seq;
+	char name[PIADAGIOFP_BANK_NAME_LEN];
+};
+
+// A glyph bank has been loaded (or failed to)
+// The bank is applied in one go, only the glyphs that differ from those
+// resident are flagged for upload. If another bank has been requested
+// since, this one is dropped.
+static void piadagio_fp_bank_loaded(const struct firmware *fw, void *context) {
+	struct piadagio_fp_bank_request *req = context;
+	struct piadagio_fp_data *data = req->data;
+
+	if (fw == NULL) {
+		printe("%s: Failed to load glyph bank '%s'!\n", __FUNCTION__, req->name);
+	} else if (fw->size != GLYPH_BUFFER_LEN) {
+		printe("%s: Glyph bank '%s' is the wrong size (%zu bytes)!\n", __FUNCTION__, req->name, fw->size);
+	} else {
+		mutex_lock(&data->bank_lock);
+		if (req->seq == data->bank_seq) {
+			strscpy(data->bank_name, req->name, sizeof(data->bank_name));
+			if (piadagio_fp_glyph_update(&data->buffer_lcd_ugram, data->glyph_updated, fw->data) && (!READ_ONCE(data->wq_kill))) {
+				piadagio_fp_activity(data);
+				mod_delayed_work(data->wq, &data->wq_task_lcd, 0);
+			}
+		}
+		mutex_unlock(&data->bank_lock);
+	}
+
+	release_firmware(fw);
+	kfree(req);
+	if (atomic_dec_and_test(&data->bank_loads)) {
+		wake_up_all(&data->bank_wait);
+	}
+}
+
+// Request a glyph bank (loaded asynchronously)
+static int piadagio_fp_bank_load(struct piadagio_fp_data *data, const char *name) {
+	struct piadagio_fp_bank_request *req;
+	char tmp_path[sizeof(PIADAGIOFP_BANK_PATH) + PIADAGIOFP_BANK_NAME_LEN + 4];
+	int retval;
+
+	if (!piadagio_fp_bank_name_valid(name)) {
+		return -EINVAL;
+	}
+
+	req = kzalloc(sizeof(struct piadagio_fp_bank_request), GFP_KERNEL);
+	if (!req) {
+		return -ENOMEM;
+	}
+	req->data = data;
+	strscpy(req->name, name, sizeof(req->name));
+	mutex_lock(&data->bank_lock);
+	req->seq = ++data->bank_seq;
+	mutex_unlock(&data->bank_lock);
+
+	snprintf(tmp_path, sizeof(tmp_path), PIADAGIOFP_BANK_PATH "%s.bin", name);
+	atomic_inc(&data->bank_loads);
+	retval = request_firmware_nowait(THIS_MODULE, true, tmp_path, &data->client->dev, GFP_KERNEL, req, piadagio_fp_bank_loaded);
+	if (retval < 0) {
+		atomic_dec(&data->bank_loads);
+		kfree(req);
+	}
+	return retval;
+}
+
+/////////////////////////////////////////////////////////////////////
+// Geometry routines
+/////////////////////////////////////////////////////////////////////
+// Read the panel geometry from the DT properties ('rows', 'columns',
+// and optionally 'line-interleave'), the default is 20x4
+// Returns 0, or -EINVAL if the geometry can't be driven.
+static int piadagio_fp_geometry_read(struct piadagio_fp_data *data) {
+	struct device *dev = &data->client->dev;
+	u32 tmp_rows = 4, tmp_cols = LCD_LINE_LEN;
+	u8 tmp_interleave[PIADAGIOFP_ROWS_MAX];
+	int tmp_len;
+
+	device_property_read_u32(dev, "rows", &tmp_rows);
+	device_property_read_u32(dev, "columns", &tmp_cols);
+
+	tmp_len = device_property_count_u8(dev, "line-interleave");
+	if (tmp_len > 0) {
+		if (((u32) tmp_len != tmp_rows) || (tmp_len > PIADAGIOFP_ROWS_MAX) ||
+				(device_property_read_u8_array(dev, "line-interleave", tmp_interleave, tmp_len) < 0)) {
+			return -EINVAL;
+		}
+		return piadagio_fp_geometry_init(&data->geometry, tmp_rows, tmp_cols, tmp_interleave);
+	}
+	return piadagio_fp_geometry_init(&data->geometry, tmp_rows, tmp_cols, NULL);
+}
+
+/////////////////////////////////////////////////////////////////////
+// Splash routines
+/////////////////////////////////////////////////////////////////////
+// Fill the buffers with the splash text and glyphs
+// The DT properties take precedence over the module parameters. With
+// no splash text, the screen is just cleared.
+static void piadagio_fp_splash_init(struct piadagio_fp_data *data) {
+	struct device *dev = &data->client->dev;
+	const char *tmp_text;
+	u8 tmp_glyphs[GLYPH_BUFFER_LEN];
+
+	printd("%s\n", __FUNCTION__);
+
+	if (device_property_read_string(dev, "splash", &tmp_text) < 0) {
+		tmp_text = fp_splash;
+	}
+	piadagio_fp_splash_render(&data->geometry, &data->buffer_lcd_screen, tmp_text);
+
+	if (device_property_read_u8_array(dev, "splash-glyphs", tmp_glyphs, GLYPH_BUFFER_LEN) == 0) {
+		piadagio_fp_glyph_update(&data->buffer_lcd_ugram, data->glyph_updated, tmp_glyphs);
+	} else if (fp_splash_glyphs[0] != 0) {
+		if ((strlen(fp_splash_glyphs) == (2 * GLYPH_BUFFER_LEN)) && (hex2bin(tmp_glyphs, fp_splash_glyphs, GLYPH_BUFFER_LEN) == 0)) {
+			piadagio_fp_glyph_update(&data->buffer_lcd_ugram, data->glyph_updated, tmp_glyphs);
+		} else {
+			printe("%s: Invalid splash glyphs!\n", __FUNCTION__);
+		}
+	}
+}
+
 /////////////////////////////////////////////////////////////////////
 // Workqueue routines
 /////////////////////////////////////////////////////////////////////
+// Checks whether any glyphs need updating
+static bool piadagio_fp_glyph_pending(struct piadagio_fp_data *data) {
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		if (data->glyph_updated[i]) {
+			return true;
+		}
+	}
+	return false;
+}
+
 // Task to periodically update the lcd screen from the buffer
 static void piadagio_fp_task_lcd_update(struct work_struct *work) {
+	struct piadagio_fp_data *data = container_of(to_delayed_work(work), struct piadagio_fp_data, wq_task_lcd);
 	bool update_screen = true;
 	int fp_status, i;
-	short task_delay = 10;
+	unsigned long task_delay = PIADAGIOFP_REFRESH_DELAY;
 
 	//printd("%s\n", __FUNCTION__);
 
-	if (piadagio_fp_i2c_update_do > 0) {						// Check whether to run an update
-		fp_status = piadagio_fp_i2c_get_status();				// Check the FP status,
+	if (piadagio_fp_idle_check(data)) {					// Nothing happening, so stop updating
+		piadagio_fp_idle_enter(data);
+		return;
+	}
+
+	// Resync requested, or due? The firmware doesn't report a reset, and
+	// a short brownout doesn't cause enough errors to be detected, so
+	// the panel is periodically resent everything while active.
+	if (READ_ONCE(data->resync_pending)) {
+		WRITE_ONCE(data->resync_pending, false);
+		piadagio_fp_shadow_invalidate(data);
+		piadagio_fp_stats_inc(data, PIADAGIOFP_STAT_RESYNCS);
+		if (!READ_ONCE(data->wq_kill)) {
+			mod_delayed_work(data->wq, &data->wq_task_led, 0);
+		}
+	} else if ((data->frame_halves == 0) && time_after(jiffies, data->shadow_resync_last + (PIADAGIOFP_RESYNC_INTERVAL * HZ))) {
+		piadagio_fp_shadow_invalidate(data);
+		if (!READ_ONCE(data->wq_kill)) {
+			mod_delayed_work(data->wq, &data->wq_task_led, 0);
+		}
+	}
+
+	// Too early for the next frame, and nothing else to do?
+	task_delay = piadagio_fp_frame_hold(data);
+	if ((task_delay > 0) && !piadagio_fp_glyph_pending(data)) {
+		if (!READ_ONCE(data->wq_kill)) {
+			queue_delayed_work(data->wq, &data->wq_task_lcd, task_delay);
+		}
+		return;
+	}
+	task_delay = PIADAGIOFP_REFRESH_DELAY;
+
+	if (data->i2c_update_do > 0) {						// Check whether to run an update
+		fp_status = piadagio_fp_i2c_get_status(data);				// Check the FP status,
 
 		if (fp_status >= 0) {
-			if (fp_status < 2) {						// Is it ready for another command?
+			if (fp_status < I2C_FP_STATUS_BUSY) {				// Is it ready for another command?
 				for (i = 0; i < 8; i++) {				// Check if the glyphs need updating
-					if (piadagio_fp_glyph_updated[i]) {
-						fp_status = piadagio_fp_i2c_update_glyph(i);
+					if (data->glyph_updated[i]) {
+						if (piadagio_fp_shadow_glyph_current(&data->shadow, i, &data->buffer_lcd_ugram.glyph[i])) {
+							data->glyph_updated[i] = false;	// Panel already has it
+							piadagio_fp_stats_inc(data, PIADAGIOFP_STAT_UPDATES_SUPPRESSED);
+							continue;
+						}
+						fp_status = piadagio_fp_i2c_update_glyph(data, i);
 						if (fp_status == 0) {			// Did the write succeed?
-							piadagio_fp_glyph_updated[i] = false;
-							piadagio_fp_i2c_update_glyph_counter++;
+							data->glyph_updated[i] = false;
+							piadagio_fp_stats_inc(data, PIADAGIOFP_STAT_UPDATE_GLYPH);
+							if (piadagio_fp_glyph_pending(data)) {
+								task_delay = 1;		// More to send, so a bank lands in one burst
+							}
 						} else {
-							piadagio_fp_i2c_update_errors_counter++;
+							piadagio_fp_stats_inc(data, PIADAGIOFP_STAT_ERRORS_GLYPH);
 							task_delay = 1;
 						}
 						update_screen = false;			// Stop screen update as glyph update has to be processed
@@ -289,163 +1158,453 @@ static void piadagio_fp_task_lcd_update(struct work_struct *work) {
 				}
 
 				// Can we update the screen? Waiting for fsync?
-				if (update_screen && (piadagio_fp_i2c_update_do_screen > 0)) {
-					piadagio_fp_i2c_update_lcd_counter++;		// Debug helper, to know if this rountine is being executed
-
-					fp_status = piadagio_fp_i2c_update_screen();
-					if (fp_status == 0) {				// Did the write succeed?
-						// Do we writing need to write the second half of the screen?
-						if (!piadagio_fp_i2c_update_screen_other_half) {
-							task_delay = 10;		// No, so wait (giving a rough refresh of 10Hz)
-						} else {
-							task_delay = 1;			// Yes, so keep the delay short
+				if (update_screen && (data->i2c_update_do_screen > 0)) {
+					if (data->frame_halves == 0) {			// Starting a new frame
+						piadagio_fp_frame_start(data);
+					}
+					if (data->frame_halves == 0) {			// Panel already shows it, nothing to send
+						piadagio_fp_frame_displayed(data);
+						task_delay = max_t(unsigned long, 1, piadagio_fp_frame_hold(data));
+					} else {
+						fp_status = piadagio_fp_i2c_update_screen(data);
+						if (fp_status == 0) {			// Did the write succeed?
+							if (data->i2c_update_screen_other_half) {
+								data->frame_halves &= ~PIADAGIOFP_SCREEN_HALF_2;
+							} else {
+								data->frame_halves &= ~PIADAGIOFP_SCREEN_HALF_1;
+							}
+							// Do we writing need to write the second half of the screen?
+							if (data->frame_halves == 0) {
+								data->i2c_update_screen_other_half = false;
+								piadagio_fp_frame_displayed(data);
+								task_delay = max_t(unsigned long, 1, piadagio_fp_frame_hold(data));	// No, so wait until the next frame
+							} else {
+								data->i2c_update_screen_other_half = true;
+								task_delay = 1;		// Yes, so keep the delay short
+							}
+							piadagio_fp_stats_inc(data, PIADAGIOFP_STAT_UPDATE_LCD);
+						} else {				// Failed write to screen, so reschedule
+							piadagio_fp_stats_inc(data, PIADAGIOFP_STAT_ERRORS_LCD);
+							task_delay = 1;
 						}
-					} else {					// Failed write to screen, so reschedule
-						piadagio_fp_i2c_update_errors_counter++;
-						task_delay = 1;
 					}
 				} else {
 					task_delay = 1;					// Waiting for buffer to be updated, so reschedule
 				}
 			} else {							// FP processing existing command so reschedule
-				piadagio_fp_i2c_update_retries_counter++;
+				if (!piadagio_fp_glyph_pending(data)) {			// Attribute the retry to the pending update
+					piadagio_fp_stats_inc(data, PIADAGIOFP_STAT_RETRIES_LCD);
+				} else {
+					piadagio_fp_stats_inc(data, PIADAGIOFP_STAT_RETRIES_GLYPH);
+				}
 				task_delay = 1;
 			}
 		} else {								// Error reading, schedule another check
-			piadagio_fp_i2c_update_errors_counter++;
+			piadagio_fp_stats_inc(data, PIADAGIOFP_STAT_ERRORS_STATUS);
 			task_delay = 1;
 		}
 	}
 
-	if (piadagio_fp_wq_kill == 0) {
-		queue_delayed_work(piadagio_fp_wq, &piadagio_fp_wq_task_lcd, task_delay);
+	if (!READ_ONCE(data->wq_kill)) {
+		queue_delayed_work(data->wq, &data->wq_task_lcd, task_delay);
 	}
 }
 
-// Task to periodically update the panel leds
+// Task to update the panel leds
+// Only sent when they differ from what the panel has acknowledged.
 static void piadagio_fp_task_led_update(struct work_struct *work) {
+	struct piadagio_fp_data *data = container_of(to_delayed_work(work), struct piadagio_fp_data, wq_task_led);
 	int fp_status;
-	short task_delay = 50;
+	short task_delay = 0;
+	bool tmp_pm_ref;
 
 	//printd("%s\n", __FUNCTION__);
 
-	if (piadagio_fp_i2c_update_do > 0) {					// Check whether to run an update
-		piadagio_fp_i2c_update_led_counter++;				// Debug helper, to know if this rountine is being executed
-		fp_status = piadagio_fp_i2c_get_status();			// Check the FP status,
+	// Check whether to run an update, and whether it's needed
+	if ((data->i2c_update_do > 0) && !piadagio_fp_shadow_leds_current(&data->shadow, data->led_online, data->led_power)) {
+		fp_status = piadagio_fp_pm_get(data);				// LED triggers still run while idle
+		tmp_pm_ref = (fp_status == 0);
+		if (tmp_pm_ref) {
+			fp_status = piadagio_fp_i2c_get_status(data);		// Check the FP status,
+		}
 
 		if (fp_status >= 0) {
-			if (fp_status < 2) {					// Is it ready for another command?
-				fp_status = piadagio_fp_i2c_update_leds();
+			if (fp_status < I2C_FP_STATUS_BUSY) {			// Is it ready for another command?
+				fp_status = piadagio_fp_i2c_update_leds(data);
 				if (fp_status == 0) {				// Did the write succeed?
-					task_delay = 50;
+					piadagio_fp_stats_inc(data, PIADAGIOFP_STAT_UPDATE_LED);
+					task_delay = 0;
 				} else {					// Failed write to LEDs, so reschedule
-					piadagio_fp_i2c_update_errors_counter++;
+					piadagio_fp_stats_inc(data, PIADAGIOFP_STAT_ERRORS_LED);
 					task_delay = 1;
 				}
 			} else {						// FP processing existing command so reschedule
-				piadagio_fp_i2c_update_retries_counter++;
+				piadagio_fp_stats_inc(data, PIADAGIOFP_STAT_RETRIES_LED);
 				task_delay = 1;
 			}
 		} else {							// Error reading, schedule another check
-			piadagio_fp_i2c_update_errors_counter++;
+			piadagio_fp_stats_inc(data, PIADAGIOFP_STAT_ERRORS_STATUS);
 			task_delay = 1;
 		}
+		if (tmp_pm_ref) {
+			piadagio_fp_pm_put(data);
+		}
+	}
+
+	// Changes are queued immediately, so only retries are queued here
+	if ((!READ_ONCE(data->wq_kill)) && (task_delay > 0)) {
+		queue_delayed_work(data->wq, &data->wq_task_led, task_delay);
+	}
+}
+
+// Task to apply the next keyframe of an animation
+// Only the screen halves/glyphs that have changed are updated, then the
+// timer is set for the next keyframe (relative to when this one was due,
+// so the timing doesn't drift).
+static void piadagio_fp_task_anim(struct work_struct *work) {
+	struct piadagio_fp_data *data = container_of(work, struct piadagio_fp_data, anim_work);
+	struct piadagio_fp_keyframe *tmp_frame;
+	u8 tmp_halves = 0;
+	bool glyph_dirty = false;
+	unsigned int i;
+
+	//printd("%s\n", __FUNCTION__);
+
+	mutex_lock(&data->anim_lock);
+	if ((data->anim_frames == NULL) || (READ_ONCE(data->wq_kill))) {		// Stopped
+		mutex_unlock(&data->anim_lock);
+		return;
+	}
+	tmp_frame = &data->anim_frames[data->anim_index];
+
+	if (tmp_frame->flags & PIADAGIOFP_KEYFRAME_GLYPHS) {
+		for (i = 0; i < 8; i++) {
+			if ((tmp_frame->glyph_mask & (1 << i)) &&
+					(memcmp(data->buffer_lcd_ugram.glyph[i].pixel_line, tmp_frame->glyphs[i], 8) != 0)) {
+				memcpy(data->buffer_lcd_ugram.glyph[i].pixel_line, tmp_frame->glyphs[i], 8);
+				data->glyph_updated[i] = true;
+				glyph_dirty = true;
+			}
+		}
+	}
+	if (tmp_frame->flags & PIADAGIOFP_KEYFRAME_SCREEN) {
+		tmp_halves = piadagio_fp_screen_diff(&data->geometry, &data->buffer_lcd_screen, tmp_frame->screen);
+		if (tmp_halves) {
+			memcpy(&data->buffer_lcd_screen, tmp_frame->screen, SCREEN_BUFFER_LEN);
+		}
+	}
+
+	if (tmp_halves) {
+		piadagio_fp_frame_queue(data);
+	} else if (glyph_dirty) {
+		piadagio_fp_activity(data);
+		mod_delayed_work(data->wq, &data->wq_task_lcd, 0);
+	}
+
+	// Move on to the next keyframe
+	data->anim_next = ktime_add_ms(data->anim_next, tmp_frame->duration_ms);
+	data->anim_index++;
+	if (data->anim_index >= data->anim_count) {
+		data->anim_index = 0;
+		if ((data->anim_loops > 0) && (--data->anim_loops == 0)) {	// Finished
+			kvfree(data->anim_frames);
+			data->anim_frames = NULL;
+			mutex_unlock(&data->anim_lock);
+			return;
+		}
+	}
+	if (ktime_before(data->anim_next, ktime_get())) {			// Fallen behind, so don't try to catch up
+		data->anim_next = ktime_get();
 	}
+	hrtimer_start(&data->anim_timer, data->anim_next, HRTIMER_MODE_ABS);
+	mutex_unlock(&data->anim_lock);
+}
+
+// Task to handle key presses for the menu
+static void piadagio_fp_task_menu(struct work_struct *work) {
+	struct piadagio_fp_data *data = container_of(work, struct piadagio_fp_data, menu_work);
+	u8 tmp_key;
 
-	if (piadagio_fp_wq_kill == 0) {
-		queue_delayed_work(piadagio_fp_wq, &piadagio_fp_wq_task_led, task_delay);
+	//printd("%s\n", __FUNCTION__);
+
+	mutex_lock(&data->menu_lock);
+	while (kfifo_get(&data->menu_keys, &tmp_key)) {
+		if (data->menu_items != NULL) {
+			piadagio_fp_menu_key(data, tmp_key);
+		}
+	}
+	mutex_unlock(&data->menu_lock);
+}
+
+// Task to poll the buttons while one is down
+// The status read steps the button state machine, which requeues this.
+static void piadagio_fp_task_buttons(struct work_struct *work) {
+	struct piadagio_fp_data *data = container_of(to_delayed_work(work), struct piadagio_fp_data, wq_task_buttons);
+	int fp_status;
+
+	//printd("%s\n", __FUNCTION__);
+
+	if (data->i2c_update_do > 0) {
+		fp_status = piadagio_fp_i2c_get_status(data);
+		if (fp_status < 0) {						// Error reading, schedule another check
+			piadagio_fp_stats_inc(data, PIADAGIOFP_STAT_ERRORS_STATUS);
+			if (!READ_ONCE(data->wq_kill)) {
+				queue_delayed_work(data->wq, &data->wq_task_buttons, 1);
+			}
+		}
+	}
+}
+
+// Task to poll the buttons while the panel is idle
+// This uses a deferrable timer, so doesn't wake an idle CPU.
+static void piadagio_fp_task_idle_poll(struct work_struct *work) {
+	struct piadagio_fp_data *data = container_of(to_delayed_work(work), struct piadagio_fp_data, wq_task_idle);
+	int fp_status;
+
+	//printd("%s\n", __FUNCTION__);
+
+	if (!data->idle) {							// Woken by something else
+		return;
+	}
+
+	if (data->i2c_update_do > 0) {
+		fp_status = piadagio_fp_pm_get(data);
+		if (fp_status == 0) {
+			fp_status = piadagio_fp_i2c_get_status(data);
+			piadagio_fp_pm_put(data);
+		}
+		if (fp_status < 0) {
+			piadagio_fp_stats_inc(data, PIADAGIOFP_STAT_ERRORS_STATUS);
+		} else if (data->buffer_command != 0) {				// Button pressed, back to full speed
+			piadagio_fp_idle_exit(data);
+			return;
+		}
+	}
+
+	if (!READ_ONCE(data->wq_kill)) {
+		queue_delayed_work(data->wq, &data->wq_task_idle, msecs_to_jiffies(fp_idle_poll));
 	}
 }
 
 ////////////////////////////////////////////////////////////////////
 // Character driver
 ////////////////////////////////////////////////////////////////////
+// Select what write() does (PIADAGIOFP_WRITE_*)
+// The mode is kept between opens, so shell tools can use text mode.
+static int piadagio_fp_set_write_mode(struct piadagio_fp_data *data, unsigned int mode) {
+	if ((mode != PIADAGIOFP_WRITE_BUFFER) && (mode != PIADAGIOFP_WRITE_TEXT)) {
+		return -EINVAL;
+	}
+	data->text.state = PIADAGIOFP_TEXT_NORMAL;
+	data->write_mode = mode;
+	return 0;
+}
+
+// The panel can be removed while the device file is open, the data
+// outlives it (see piadagio_fp_chrdev_release), but the client doesn't.
+// So every file operation holds remove_lock, and checks the client.
+static bool piadagio_fp_file_get(struct piadagio_fp_data *data) {
+	down_read(&data->remove_lock);
+	if (data->client == NULL) {
+		up_read(&data->remove_lock);
+		return false;
+	}
+	return true;
+}
+
+static void piadagio_fp_file_put(struct piadagio_fp_data *data) {
+	up_read(&data->remove_lock);
+}
+
 // Called when device is first opened
 static int piadagio_fp_open(struct inode * inode, struct file *fp) {
+	struct piadagio_fp_data *data = container_of(inode->i_cdev, struct piadagio_fp_data, cdev);
+
 	printd("%s: Attempt to open our device\n", __FUNCTION__);
 
 	// Ensure only one device accesses at a time
-	if (!mutex_trylock(&piadagio_fp_mutex)) {
+	if (!mutex_trylock(&data->open_lock)) {
 		printd("%s: Device currently in use!\n", __FUNCTION__);
 		return -EBUSY;
 	}
 
 	// Ensure that the i2c client is available
-	if (piadagio_fp_i2c_client == NULL) {
+	if (!piadagio_fp_file_get(data)) {
+		mutex_unlock(&data->open_lock);
 		return -ENODEV;
 	}
-
-	piadagio_fp_buffer_index_ptr = piadagio_fp_buffer_lcd_screen.line1;		// Reset screen buffer pointer
-	piadagio_fp_glyph_index_ptr = piadagio_fp_buffer_lcd_ugram.glyph[0].pixel_line;	// Reset UGRAM buffer pointer
-	piadagio_fp_write_to_buffer = BUFFER_WRITE_CHAR;				// Reset to writing character buffer
+	piadagio_fp_file_put(data);
+
+	fp->private_data = data;
+	data->buffer_index = 0;						// Reset screen buffer position
+	data->glyph_index = 0;						// Reset UGRAM buffer position
+	data->canvas_index = 0;						// Reset canvas buffer position
+	data->read_mode = PIADAGIOFP_READ_COMMAND;			// Reset to reading the raw command
+	kfifo_reset_out(&data->events);					// Drop any stale events
+	data->text.state = PIADAGIOFP_TEXT_NORMAL;			// Drop any partial escape sequence (the cursor is kept)
+	data->write_to_buffer = BUFFER_WRITE_CHAR;			// Reset to writing character buffer
 	return 0;
 }
 
 // Called when the device file pointer is closed
 static int piadagio_fp_release(struct inode * inode, struct file * fp) {
+	struct piadagio_fp_data *data = fp->private_data;
+
 	printd("%s: Freeing /dev resource\n", __FUNCTION__);
 
-	mutex_unlock(&piadagio_fp_mutex);
+	mutex_unlock(&data->open_lock);
 	return 0;
 }
 
 // Read from the device
-static ssize_t piadagio_fp_read(struct file *filp,			/* see include/linux/fs.h   */
+static ssize_t piadagio_fp_do_read(struct file *filp,			/* see include/linux/fs.h   */
 				char __user *buffer,			/* buffer to fill with data */
 				size_t length,				/* length of the buffer     */
 				loff_t * offset) {
+	struct piadagio_fp_data *data = filp->private_data;
+	unsigned int tmp_copied;
+	int retval;
+
 	printd("%s\n", __FUNCTION__);
 
+	if (data->read_mode == PIADAGIOFP_READ_EVENTS) {
+		if (length < sizeof(struct piadagio_fp_event)) {
+			return -EINVAL;
+		}
+		if (kfifo_is_empty(&data->events)) {
+			if (filp->f_flags & O_NONBLOCK) {
+				return -EAGAIN;
+			}
+			if (wait_event_interruptible(data->event_wait, (!kfifo_is_empty(&data->events) || READ_ONCE(data->wq_kill)))) {
+				return -ERESTARTSYS;
+			}
+			if (kfifo_is_empty(&data->events)) {
+				return -ENODEV;
+			}
+		}
+
+		// Only whole events are returned
+		mutex_lock(&data->event_read_lock);
+		retval = kfifo_to_user(&data->events, buffer, rounddown(length, sizeof(struct piadagio_fp_event)), &tmp_copied);
+		mutex_unlock(&data->event_read_lock);
+		if (retval < 0) {
+			return retval;
+		}
+		return tmp_copied;
+	}
+
 	// We're just interested in any commands read from the FP
-	if (copy_to_user(buffer, &piadagio_fp_buffer_command, 1) == 0) {
+	if (copy_to_user(buffer, &data->buffer_command, 1) == 0) {
 		return 1;
 	}
 
 	return -EFAULT;
 }
 
+// Write a text stream to the screen (text mode)
+// Parsed a chunk at a time, a form feed commits the screen. Otherwise
+// changes are committed at the end of the write (unless fsync is
+// required).
+static ssize_t piadagio_fp_text_write(struct piadagio_fp_data *data, const char __user * buffer, size_t count) {
+	unsigned char tmp_chunk[PIADAGIOFP_TEXT_CHUNK];
+	size_t num_write = 0, tmp_len, i;
+	bool tmp_pending = false;
+	u8 tmp_result;
+
+	while (num_write < count) {
+		tmp_len = min_t(size_t, count - num_write, PIADAGIOFP_TEXT_CHUNK);
+		if (copy_from_user(tmp_chunk, (buffer + num_write), tmp_len)) {
+			return -EFAULT;
+		}
+
+		for (i = 0; i < tmp_len; i++) {
+			tmp_result = piadagio_fp_text_feed(&data->geometry, &data->text, &data->buffer_lcd_screen, &data->buffer_lcd_ugram, data->glyph_updated, tmp_chunk[i]);
+			if (tmp_result & PIADAGIOFP_TEXT_CHANGED) {
+				data->canvas_active = false;			// Screen written directly, so stop showing the canvas
+				tmp_pending = true;
+			}
+			if (tmp_result & PIADAGIOFP_TEXT_COMMIT) {
+				piadagio_fp_frame_commit(data);
+				tmp_pending = false;
+			}
+		}
+		num_write += tmp_len;
+	}
+
+	if (tmp_pending) {
+		if (fp_require_fsync) {
+			piadagio_fp_frame_hold_for_fsync(data);
+		} else {
+			piadagio_fp_frame_commit(data);
+		}
+	}
+	return num_write;
+}
+
 // Write to the lcd screen/glyph buffer
-static ssize_t piadagio_fp_write(struct file * fp, const char __user * buffer, size_t count, loff_t * offset) {
-	int num_write = 0, tmp_glyph_index = 0;
+// Copies are done a chunk at a time, wrapping at the end of the buffer.
+static ssize_t piadagio_fp_do_write(struct file * fp, const char __user * buffer, size_t count, loff_t * offset) {
+	struct piadagio_fp_data *data = fp->private_data;
+	size_t num_write = 0, tmp_chunk;
 
 	printd("%s: Write operation with [%d] bytes, from offset [%lld]\n", __FUNCTION__, count, ((long long int) *offset));
 
-	if (piadagio_fp_write_to_buffer == BUFFER_WRITE_CHAR) {
+	if (data->write_mode == PIADAGIOFP_WRITE_TEXT) {
+		return piadagio_fp_text_write(data, buffer, count);
+	}
+
+	if (data->write_to_buffer == BUFFER_WRITE_CHAR) {
 		// Iterate through the user space buffer
 		while (count) {
-			if (copy_from_user(piadagio_fp_buffer_index_ptr, (buffer + num_write), 1)) {
+			tmp_chunk = piadagio_fp_buffer_chunk(data->buffer_index, count, SCREEN_BUFFER_LEN);
+			if (copy_from_user((data->buffer_lcd_screen.chars + data->buffer_index), (buffer + num_write), tmp_chunk)) {
 				return -EFAULT;
 			}
 
-			num_write++;
-			count--;
-			piadagio_fp_buffer_index_ptr++;
-			// Reset the screen buffer pointer, if we have overrun the end
-			if (piadagio_fp_buffer_index_ptr >= (piadagio_fp_buffer_lcd_screen.line1 + SCREEN_BUFFER_LEN)) {
-				piadagio_fp_buffer_index_ptr = piadagio_fp_buffer_lcd_screen.line1;
-			}
+			num_write += tmp_chunk;
+			count -= tmp_chunk;
+			// Reset the screen buffer position, if we have overrun the end
+			data->buffer_index = piadagio_fp_buffer_advance(data->buffer_index, tmp_chunk, SCREEN_BUFFER_LEN);
 		}
+		data->canvas_active = false;					// Screen written directly, so stop showing the canvas
 
 		if (fp_require_fsync) {
-			piadagio_fp_i2c_update_do_screen = 0;
+			piadagio_fp_frame_hold_for_fsync(data);
+		} else {
+			piadagio_fp_frame_commit(data);
 		}
-	} else if (piadagio_fp_write_to_buffer == BUFFER_WRITE_GLYPH) {
+	} else if (data->write_to_buffer == BUFFER_WRITE_GLYPH) {
 		// Iterate through the user space buffer
 		while (count) {
-			if (copy_from_user(piadagio_fp_glyph_index_ptr, (buffer + num_write), 1)) {
+			tmp_chunk = piadagio_fp_buffer_chunk(data->glyph_index, count, GLYPH_BUFFER_LEN);
+			if (copy_from_user((data->buffer_lcd_ugram.glyph[0].pixel_line + data->glyph_index), (buffer + num_write), tmp_chunk)) {
 				return -EFAULT;
 			}
 
-			tmp_glyph_index = (piadagio_fp_glyph_index_ptr - piadagio_fp_buffer_lcd_ugram.glyph[0].pixel_line) / 8;
-			piadagio_fp_glyph_updated[tmp_glyph_index] = true;
+			piadagio_fp_glyph_mark_range(data->glyph_updated, data->glyph_index, tmp_chunk);
 
-			num_write++;
-			count--;
-			piadagio_fp_glyph_index_ptr++;
-			// Reset the glyph buffer pointer, if we have overrun the end
-			if (piadagio_fp_glyph_index_ptr >= (piadagio_fp_buffer_lcd_ugram.glyph[0].pixel_line + GLYPH_BUFFER_LEN)) {
-				piadagio_fp_glyph_index_ptr = piadagio_fp_buffer_lcd_ugram.glyph[0].pixel_line;
+			num_write += tmp_chunk;
+			count -= tmp_chunk;
+			// Reset the glyph buffer position, if we have overrun the end
+			data->glyph_index = piadagio_fp_buffer_advance(data->glyph_index, tmp_chunk, GLYPH_BUFFER_LEN);
+		}
+	} else if (data->write_to_buffer == BUFFER_WRITE_CANVAS) {
+		// Iterate through the user space buffer
+		while (count) {
+			tmp_chunk = piadagio_fp_buffer_chunk(data->canvas_index, count, CANVAS_BUFFER_LEN);
+			if (copy_from_user((data->buffer_canvas + data->canvas_index), (buffer + num_write), tmp_chunk)) {
+				return -EFAULT;
 			}
+
+			num_write += tmp_chunk;
+			count -= tmp_chunk;
+			// Reset the canvas buffer position, if we have overrun the end
+			data->canvas_index = piadagio_fp_buffer_advance(data->canvas_index, tmp_chunk, CANVAS_BUFFER_LEN);
+		}
+
+		// Canvas changes are shown on commit
+		if (data->canvas_active && !fp_require_fsync) {
+			piadagio_fp_frame_commit(data);
 		}
 	}
 
@@ -453,7 +1612,11 @@ static ssize_t piadagio_fp_write(struct file * fp, const char __user * buffer, s
 }
 
 // Basic implmentation of llseek, only seeks from the start
-static loff_t piadagio_fp_llseek(struct file *file, loff_t offset, int origin) {
+static loff_t piadagio_fp_do_llseek(struct file *file, loff_t offset, int origin) {
+	struct piadagio_fp_data *data = file->private_data;
+	unsigned int tmp_index;
+	int tmp_buffer;
+
 	printd("%s: llseek to offset [%llu]\n", __FUNCTION__, ((long long int) offset));
 
 	if (origin != SEEK_SET) {
@@ -461,114 +1624,439 @@ static loff_t piadagio_fp_llseek(struct file *file, loff_t offset, int origin) {
 		return -EFAULT;
 	}
 
-	if (offset < SCREEN_BUFFER_LEN) {
-		piadagio_fp_buffer_index_ptr = piadagio_fp_buffer_lcd_screen.line1;
-		piadagio_fp_buffer_index_ptr += offset;
-
-		piadagio_fp_write_to_buffer = BUFFER_WRITE_CHAR;
-	} else if ((offset >= 128) && (offset <= (128 + (GLYPH_BUFFER_LEN - 1)))) {
-		piadagio_fp_glyph_index_ptr = piadagio_fp_buffer_lcd_ugram.glyph[0].pixel_line;
-		piadagio_fp_glyph_index_ptr += (offset - 128);
-
-		piadagio_fp_write_to_buffer = BUFFER_WRITE_GLYPH;
+	tmp_buffer = piadagio_fp_offset_decode(offset, &tmp_index);
+	if (tmp_buffer == BUFFER_WRITE_CHAR) {
+		data->buffer_index = tmp_index;
+	} else if (tmp_buffer == BUFFER_WRITE_GLYPH) {
+		data->glyph_index = tmp_index;
+	} else if (tmp_buffer == BUFFER_WRITE_CANVAS) {
+		data->canvas_index = tmp_index;
 	} else {
 		return -EFAULT;
 	}
+	data->write_to_buffer = tmp_buffer;
 
 	return offset;
 }
 
 // This allows the screen buffer to be flushed to the FP
-static int piadagio_fp_fsync(struct file *file, loff_t start, loff_t end, int datasync) {
-	piadagio_fp_i2c_update_do_screen = 1;
+// Optionally (fp_fsync_wait) waits until the frame has been displayed.
+static int piadagio_fp_do_fsync(struct file *file, loff_t start, loff_t end, int datasync) {
+	struct piadagio_fp_data *data = file->private_data;
+	u32 tmp_seq;
+
+	tmp_seq = piadagio_fp_frame_commit(data);
+	if (fp_fsync_wait) {
+		return piadagio_fp_frame_wait(data, tmp_seq);
+	}
 	return 0;
 }
 
-static struct file_operations piadagio_fp_fops = {
-	.owner = THIS_MODULE,
-	.read = piadagio_fp_read,
-	.write = piadagio_fp_write,
-	.llseek = piadagio_fp_llseek,
-	.fsync = piadagio_fp_fsync,
-	.open = piadagio_fp_open,
-	.release = piadagio_fp_release
-};
+// Device specific operations
+static long piadagio_fp_do_ioctl(struct file *file, unsigned int cmd, unsigned long arg) {
+	struct piadagio_fp_data *data = file->private_data;
+	void __user *argp = (void __user *) arg;
+	struct piadagio_fp_commit tmp_commit;
+	struct piadagio_fp_animation tmp_anim;
+	struct piadagio_fp_menu tmp_menu;
+	struct piadagio_fp_big_text tmp_big;
+	u32 tmp_seq;
+
+	printd("%s: cmd [0x%x]\n", __FUNCTION__, cmd);
+
+	switch (cmd) {
+	case PIADAGIOFP_IOC_COMMIT:
+		if (copy_from_user(&tmp_commit, argp, sizeof(tmp_commit))) {
+			return -EFAULT;
+		}
+		tmp_commit.seq = piadagio_fp_frame_commit(data);
+		if (copy_to_user(argp, &tmp_commit, sizeof(tmp_commit))) {
+			return -EFAULT;
+		}
+		if (tmp_commit.flags & PIADAGIOFP_COMMIT_WAIT) {
+			return piadagio_fp_frame_wait(data, tmp_commit.seq);
+		}
+		return 0;
+	case PIADAGIOFP_IOC_WAIT_FRAME:
+		if (get_user(tmp_seq, (u32 __user *) argp)) {
+			return -EFAULT;
+		}
+		return piadagio_fp_frame_wait(data, tmp_seq);
+	case PIADAGIOFP_IOC_GET_DISPLAYED:
+		tmp_seq = READ_ONCE(data->frame_displayed_seq);
+		return put_user(tmp_seq, (u32 __user *) argp);
+	case PIADAGIOFP_IOC_ANIM_START:
+		if (copy_from_user(&tmp_anim, argp, sizeof(tmp_anim))) {
+			return -EFAULT;
+		}
+		return piadagio_fp_anim_start(data, &tmp_anim);
+	case PIADAGIOFP_IOC_ANIM_STOP:
+		piadagio_fp_anim_stop(data);
+		return 0;
+	case PIADAGIOFP_IOC_SET_VIEWPORT:
+		if (get_user(tmp_seq, (u32 __user *) argp)) {
+			return -EFAULT;
+		}
+		return piadagio_fp_frame_set_viewport(data, tmp_seq);
+	case PIADAGIOFP_IOC_SET_READ_MODE:
+		if (get_user(tmp_seq, (u32 __user *) argp)) {
+			return -EFAULT;
+		}
+		if ((tmp_seq != PIADAGIOFP_READ_COMMAND) && (tmp_seq != PIADAGIOFP_READ_EVENTS)) {
+			return -EINVAL;
+		}
+		data->read_mode = tmp_seq;
+		return 0;
+	case PIADAGIOFP_IOC_MENU_START:
+		if (copy_from_user(&tmp_menu, argp, sizeof(tmp_menu))) {
+			return -EFAULT;
+		}
+		return piadagio_fp_menu_start(data, &tmp_menu);
+	case PIADAGIOFP_IOC_MENU_STOP:
+		piadagio_fp_menu_stop(data);
+		return 0;
+	case PIADAGIOFP_IOC_BIG_TEXT:
+		if (copy_from_user(&tmp_big, argp, sizeof(tmp_big))) {
+			return -EFAULT;
+		}
+		return piadagio_fp_big_text(data, tmp_big.row, tmp_big.col, tmp_big.text, PIADAGIOFP_BIG_TEXT_LEN);
+	case PIADAGIOFP_IOC_SET_WRITE_MODE:
+		if (get_user(tmp_seq, (u32 __user *) argp)) {
+			return -EFAULT;
+		}
+		return piadagio_fp_set_write_mode(data, tmp_seq);
+	}
+
+	return -ENOTTY;
+}
+
+// Poll for the last committed frame to be displayed (writable), the
+// button command can always be read (events when one is queued).
+static __poll_t piadagio_fp_do_poll(struct file *file, poll_table *wait) {
+	struct piadagio_fp_data *data = file->private_data;
+	__poll_t mask = 0;
+
+	poll_wait(file, &data->frame_wait, wait);
+	poll_wait(file, &data->event_wait, wait);
+	if ((data->read_mode != PIADAGIOFP_READ_EVENTS) || !kfifo_is_empty(&data->events)) {
+		mask |= EPOLLIN | EPOLLRDNORM;
+	}
+	if (piadagio_fp_frame_is_displayed(data, READ_ONCE(data->frame_commit_seq))) {
+		mask |= EPOLLOUT | EPOLLWRNORM;
+	}
+	if (READ_ONCE(data->wq_kill)) {
+		mask |= EPOLLHUP;
+	}
+	return mask;
+}
+
+static ssize_t piadagio_fp_read(struct file *filp, char __user *buffer, size_t length, loff_t * offset) {
+	struct piadagio_fp_data *data = filp->private_data;
+	ssize_t retval;
+
+	if (!piadagio_fp_file_get(data)) {
+		return -ENODEV;
+	}
+	retval = piadagio_fp_do_read(filp, buffer, length, offset);
+	piadagio_fp_file_put(data);
+	return retval;
+}
+
+static ssize_t piadagio_fp_write(struct file * fp, const char __user * buffer, size_t count, loff_t * offset) {
+	struct piadagio_fp_data *data = fp->private_data;
+	ssize_t retval;
+
+	if (!piadagio_fp_file_get(data)) {
+		return -ENODEV;
+	}
+	retval = piadagio_fp_do_write(fp, buffer, count, offset);
+	piadagio_fp_file_put(data);
+	return retval;
+}
+
+static loff_t piadagio_fp_llseek(struct file *file, loff_t offset, int origin) {
+	struct piadagio_fp_data *data = file->private_data;
+	loff_t retval;
+
+	if (!piadagio_fp_file_get(data)) {
+		return -ENODEV;
+	}
+	retval = piadagio_fp_do_llseek(file, offset, origin);
+	piadagio_fp_file_put(data);
+	return retval;
+}
+
+static int piadagio_fp_fsync(struct file *file, loff_t start, loff_t end, int datasync) {
+	struct piadagio_fp_data *data = file->private_data;
+	int retval;
+
+	if (!piadagio_fp_file_get(data)) {
+		return -ENODEV;
+	}
+	retval = piadagio_fp_do_fsync(file, start, end, datasync);
+	piadagio_fp_file_put(data);
+	return retval;
+}
+
+static long piadagio_fp_ioctl(struct file *file, unsigned int cmd, unsigned long arg) {
+	struct piadagio_fp_data *data = file->private_data;
+	long retval;
+
+	if (!piadagio_fp_file_get(data)) {
+		return -ENODEV;
+	}
+	retval = piadagio_fp_do_ioctl(file, cmd, arg);
+	piadagio_fp_file_put(data);
+	return retval;
+}
+
+static __poll_t piadagio_fp_poll(struct file *file, poll_table *wait) {
+	struct piadagio_fp_data *data = file->private_data;
+	__poll_t mask;
+
+	if (!piadagio_fp_file_get(data)) {
+		return EPOLLHUP | EPOLLERR;
+	}
+	mask = piadagio_fp_do_poll(file, wait);
+	piadagio_fp_file_put(data);
+	return mask;
+}
+
+static struct file_operations piadagio_fp_fops = {
+	.owner = THIS_MODULE,
+	.read = piadagio_fp_read,
+	.write = piadagio_fp_write,
+	.llseek = piadagio_fp_llseek,
+	.fsync = piadagio_fp_fsync,
+	.unlocked_ioctl = piadagio_fp_ioctl,
+	.compat_ioctl = compat_ptr_ioctl,
+	.poll = piadagio_fp_poll,
+	.open = piadagio_fp_open,
+	.release = piadagio_fp_release
+};
+
+////////////////////////////////////////////////////////////////////
+// LED class
+////////////////////////////////////////////////////////////////////
+// Set an LED from the LED class (may be called from a trigger, in
+// atomic context), the change is sent immediately by the LED task.
+static void piadagio_fp_led_online_set(struct led_classdev *led_cdev, enum led_brightness brightness) {
+	struct piadagio_fp_data *data = container_of(led_cdev, struct piadagio_fp_data, led_cdev_online);
+
+	data->led_online = (brightness != LED_OFF);
+	if (!READ_ONCE(data->wq_kill)) {
+		mod_delayed_work(data->wq, &data->wq_task_led, 0);
+	}
+}
+
+static enum led_brightness piadagio_fp_led_online_get(struct led_classdev *led_cdev) {
+	struct piadagio_fp_data *data = container_of(led_cdev, struct piadagio_fp_data, led_cdev_online);
+
+	return (data->led_online > 0) ? LED_ON : LED_OFF;
+}
+
+static void piadagio_fp_led_power_set(struct led_classdev *led_cdev, enum led_brightness brightness) {
+	struct piadagio_fp_data *data = container_of(led_cdev, struct piadagio_fp_data, led_cdev_power);
+
+	data->led_power = (brightness != LED_OFF);
+	if (!READ_ONCE(data->wq_kill)) {
+		mod_delayed_work(data->wq, &data->wq_task_led, 0);
+	}
+}
+
+static enum led_brightness piadagio_fp_led_power_get(struct led_classdev *led_cdev) {
+	struct piadagio_fp_data *data = container_of(led_cdev, struct piadagio_fp_data, led_cdev_power);
+
+	return (data->led_power > 0) ? LED_ON : LED_OFF;
+}
+
+// Register the panel LEDs with the LED class
+// The first panel's LEDs are piadagio_fp_led_online/power, others have
+// the panel number added (piadagio_fp<n>_led_online/power).
+// These are unregistered by piadagio_fp_leds_unregister (in remove),
+// as the callbacks use the panel data.
+static void piadagio_fp_leds_register(struct piadagio_fp_data *data, int minor) {
+	struct device *dev = &data->client->dev;
+	int retval;
+
+	if (minor == 0) {
+		data->led_cdev_online.name = PIADAGIOFP_I2C_DEVNAME "_led_online";
+		data->led_cdev_power.name = PIADAGIOFP_I2C_DEVNAME "_led_power";
+	} else {
+		data->led_cdev_online.name = devm_kasprintf(dev, GFP_KERNEL, PIADAGIOFP_I2C_DEVNAME "%d_led_online", minor);
+		data->led_cdev_power.name = devm_kasprintf(dev, GFP_KERNEL, PIADAGIOFP_I2C_DEVNAME "%d_led_power", minor);
+		if (!data->led_cdev_online.name || !data->led_cdev_power.name) {
+			printe("%s: Failed to allocate LED names!\n", __FUNCTION__);
+			return;
+		}
+	}
+
+	data->led_cdev_online.max_brightness = 1;
+	data->led_cdev_online.brightness = (data->led_online > 0) ? LED_ON : LED_OFF;
+	data->led_cdev_online.brightness_set = piadagio_fp_led_online_set;
+	data->led_cdev_online.brightness_get = piadagio_fp_led_online_get;
+	retval = led_classdev_register(dev, &data->led_cdev_online);
+	if (retval < 0) {
+		printe("%s: Failed to register online LED! (%d)\n", __FUNCTION__, retval);
+	}
+
+	data->led_cdev_power.max_brightness = 1;
+	data->led_cdev_power.brightness = (data->led_power > 0) ? LED_ON : LED_OFF;
+	data->led_cdev_power.brightness_set = piadagio_fp_led_power_set;
+	data->led_cdev_power.brightness_get = piadagio_fp_led_power_get;
+	retval = led_classdev_register(dev, &data->led_cdev_power);
+	if (retval < 0) {
+		printe("%s: Failed to register power LED! (%d)\n", __FUNCTION__, retval);
+	}
+}
+
+// Unregister the panel LEDs (those that were registered)
+static void piadagio_fp_leds_unregister(struct piadagio_fp_data *data) {
+	if (!IS_ERR_OR_NULL(data->led_cdev_online.dev)) {
+		led_classdev_unregister(&data->led_cdev_online);
+	}
+	if (!IS_ERR_OR_NULL(data->led_cdev_power.dev)) {
+		led_classdev_unregister(&data->led_cdev_power);
+	}
+}
 
 ////////////////////////////////////////////////////////////////////
 // SysFS
 ////////////////////////////////////////////////////////////////////
 // SysFS object to display current command
 static ssize_t piadagio_fp_get_command(struct device *dev, struct device_attribute *dev_attr, char * buf) {
+	struct piadagio_fp_data *data = dev_get_drvdata(dev);
 	printd("%s\n", __FUNCTION__);
 	// Copy the result back to buf
-	return sprintf(buf, "FP Command: 0x%x (None)\n", piadagio_fp_buffer_command);
+	return sprintf(buf, "FP Command: 0x%x (None)\n", data->buffer_command);
 }
 
 // SysFS object to display the lcd buffer
 static ssize_t piadagio_fp_get_lcd_buffer(struct device *dev, struct device_attribute *dev_attr, char * buf) {
+	struct piadagio_fp_data *data = dev_get_drvdata(dev);
+	unsigned int i;
+	ssize_t tmp_len = 0;
 	printd("%s\n", __FUNCTION__);
-	// Copy the result back to buf
-	return sprintf(buf, "%.*s\n%.*s\n%.*s\n%.*s\n",
-				LCD_LINE_LEN,piadagio_fp_buffer_lcd_screen.line1,
-				LCD_LINE_LEN,piadagio_fp_buffer_lcd_screen.line2,
-				LCD_LINE_LEN,piadagio_fp_buffer_lcd_screen.line3,
-				LCD_LINE_LEN,piadagio_fp_buffer_lcd_screen.line4);
+	// Copy the result back to buf, a line per row
+	for (i = 0; i < data->geometry.rows; i++) {
+		tmp_len += sprintf(buf + tmp_len, "%.*s\n", data->geometry.cols, &data->buffer_lcd_screen.chars[i * data->geometry.cols]);
+	}
+	return tmp_len;
 }
 
 // SysFS object to display update counter
 static ssize_t piadagio_fp_get_stats(struct device *dev, struct device_attribute *dev_attr, char * buf) {
+	struct piadagio_fp_data *data = dev_get_drvdata(dev);
 	printd("%s\n", __FUNCTION__);
 	// Copy the result back to buf
-	return sprintf(buf, "Update counter (LCD): %lu\nUpdate counter (Glyph): %lu\nUpdate counter (LED): %lu\nUpdate retries counter: %lu\nUpdate error counter: %lu\n",
-			piadagio_fp_i2c_update_lcd_counter,
-			piadagio_fp_i2c_update_glyph_counter,
-			piadagio_fp_i2c_update_led_counter,
-			piadagio_fp_i2c_update_retries_counter,
-			piadagio_fp_i2c_update_errors_counter);
+	return sprintf(buf, "Update counter (LCD): %lld\nUpdate counter (Glyph): %lld\nUpdate counter (LED): %lld\nUpdate retries counter: %lld\nUpdate error counter: %lld\n",
+			piadagio_fp_stats_get(data, PIADAGIOFP_STAT_UPDATE_LCD),
+			piadagio_fp_stats_get(data, PIADAGIOFP_STAT_UPDATE_GLYPH),
+			piadagio_fp_stats_get(data, PIADAGIOFP_STAT_UPDATE_LED),
+			piadagio_fp_stats_get(data, PIADAGIOFP_STAT_RETRIES_LCD) +
+			piadagio_fp_stats_get(data, PIADAGIOFP_STAT_RETRIES_GLYPH) +
+			piadagio_fp_stats_get(data, PIADAGIOFP_STAT_RETRIES_LED),
+			piadagio_fp_stats_get(data, PIADAGIOFP_STAT_ERRORS_STATUS) +
+			piadagio_fp_stats_get(data, PIADAGIOFP_STAT_ERRORS_LCD) +
+			piadagio_fp_stats_get(data, PIADAGIOFP_STAT_ERRORS_GLYPH) +
+			piadagio_fp_stats_get(data, PIADAGIOFP_STAT_ERRORS_LED));
+}
+
+// SysFS object to display the counters, one key=value per line
+static ssize_t piadagio_fp_get_counters(struct device *dev, struct device_attribute *dev_attr, char * buf) {
+	struct piadagio_fp_data *data = dev_get_drvdata(dev);
+	unsigned int i;
+	ssize_t tmp_index = 0;
+
+	printd("%s\n", __FUNCTION__);
+	for (i = 0; i < PIADAGIOFP_STAT_MAX; i++) {
+		tmp_index += scnprintf((buf + tmp_index), (PAGE_SIZE - tmp_index), "%s=%lld\n",
+					piadagio_fp_stat_names[i], piadagio_fp_stats_get(data, i));
+	}
+	return tmp_index;
+}
+
+// SysFS object to reset the counters (write 1)
+static ssize_t piadagio_fp_set_counters_reset(struct device *dev, struct device_attribute * devattr, const char * buf, size_t count) {
+	struct piadagio_fp_data *data = dev_get_drvdata(dev);
+	int value, err;
+	printd("%s\n", __FUNCTION__);
+	err = kstrtoint(buf, 10, &value);
+	if (err < 0) {
+		return err;
+	} else if (value > 0) {
+		piadagio_fp_stats_reset(data);
+	}
+	return count;
 }
 
 // SysFS object to display whether the update is enabled
 static ssize_t piadagio_fp_get_do_update(struct device *dev, struct device_attribute *dev_attr, char * buf) {
+	struct piadagio_fp_data *data = dev_get_drvdata(dev);
 	printd("%s\n", __FUNCTION__);
 	// Copy the result back to buf
-	return sprintf(buf, "Update enabled: %u\n", piadagio_fp_i2c_update_do);
+	return sprintf(buf, "Update enabled: %u\n", data->i2c_update_do);
 }
 
 // SysFS object to set whether the update is enabled
 static ssize_t piadagio_fp_set_do_update(struct device *dev, struct device_attribute * devattr, const char * buf, size_t count) {
+	struct piadagio_fp_data *data = dev_get_drvdata(dev);
 	int value, err;
 	printd("%s\n", __FUNCTION__);
 	err = kstrtoint(buf, 10, &value);
 	if (err < 0) {
 		return err;
 	} else {
-		piadagio_fp_i2c_update_do = value;
+		data->i2c_update_do = value;
+		if ((value > 0) && (!READ_ONCE(data->wq_kill))) {			// Catch up with any LED changes
+			mod_delayed_work(data->wq, &data->wq_task_led, 0);
+		}
+	}
+	return count;
+}
+
+// SysFS object to discard the shadow of the panel state, resending everything
+static ssize_t piadagio_fp_set_resync(struct device *dev, struct device_attribute * devattr, const char * buf, size_t count) {
+	struct piadagio_fp_data *data = dev_get_drvdata(dev);
+	int value, err;
+	printd("%s\n", __FUNCTION__);
+	err = kstrtoint(buf, 10, &value);
+	if (err < 0) {
+		return err;
+	} else if (value > 0) {
+		WRITE_ONCE(data->resync_pending, true);				// Done by the LCD task, which owns the shadow
+		if ((!READ_ONCE(data->wq_kill)) && (!READ_ONCE(data->idle))) {	// Otherwise done when leaving idle
+			mod_delayed_work(data->wq, &data->wq_task_lcd, 0);
+		}
 	}
 	return count;
 }
 
 // SysFS object to display whether the screen update is enabled
 static ssize_t piadagio_fp_get_do_update_screen(struct device *dev, struct device_attribute *dev_attr, char * buf) {
+	struct piadagio_fp_data *data = dev_get_drvdata(dev);
 	printd("%s\n", __FUNCTION__);
 	// Copy the result back to buf
-	return sprintf(buf, "Update enabled: %u\n", piadagio_fp_i2c_update_do_screen);
+	return sprintf(buf, "Update enabled: %u\n", data->i2c_update_do_screen);
 }
 
 // SysFS object to set whether the screen update is enabled
 static ssize_t piadagio_fp_set_do_update_screen(struct device *dev, struct device_attribute * devattr, const char * buf, size_t count) {
+	struct piadagio_fp_data *data = dev_get_drvdata(dev);
 	int value, err;
 	printd("%s\n", __FUNCTION__);
 	err = kstrtoint(buf, 10, &value);
 	if (err < 0) {
 		return err;
 	} else {
-		piadagio_fp_i2c_update_do_screen = value;
+		data->i2c_update_do_screen = value;
 	}
 	return count;
 }
 
 // SysFS object to display the i2c buffer
 static ssize_t piadagio_fp_get_i2c_buffer(struct device *dev, struct device_attribute *dev_attr, char * buf) {
+	struct piadagio_fp_data *data = dev_get_drvdata(dev);
 	int i, tmp_index;
 	printd("%s\n", __FUNCTION__);
 	// Convert the i2c buffer to hex
@@ -580,183 +2068,356 @@ static ssize_t piadagio_fp_get_i2c_buffer(struct device *dev, struct device_attr
 			}
 			tmp_index += sprintf((buf + tmp_index), "0x%u0: ", (i / 16));
 		}
-		tmp_index += sprintf((buf + tmp_index), "0x%02x ", piadagio_fp_buffer_i2c_rw[i]);
+		tmp_index += sprintf((buf + tmp_index), "0x%02x ", data->buffer_i2c_rw[i]);
 	}
 	return tmp_index;
 }
 
-// SysFS object to display UGRAM glyph 0
-static ssize_t piadagio_fp_get_ugram_glyph0(struct device *dev, struct device_attribute *dev_attr, char * buf) {
-	struct piadagio_fp_glyph tmp_glyph = piadagio_fp_buffer_lcd_ugram.glyph[0];
+// SysFS object to display a UGRAM glyph
+// The glyph index is stored in the extended attribute.
+static ssize_t piadagio_fp_get_ugram_glyph(struct device *dev, struct device_attribute *dev_attr, char * buf) {
+	struct piadagio_fp_data *data = dev_get_drvdata(dev);
+	unsigned int tmp_index = (uintptr_t) container_of(dev_attr, struct dev_ext_attribute, attr)->var;
+	unsigned char tmp_line;
+	ssize_t tmp_len;
+	unsigned int i;
 
 	printd("%s\n", __FUNCTION__);
 	// Copy the result back to buf
-	return sprintf(buf, "Glyph 0:\nUpdated: %u\n" GLYPH_PRINT, piadagio_fp_glyph_updated[0],
-				((tmp_glyph.pixel_line[0] & 16) > 0), ((tmp_glyph.pixel_line[0] & 8) > 0), ((tmp_glyph.pixel_line[0] & 4) > 0), ((tmp_glyph.pixel_line[0] & 2) > 0), ((tmp_glyph.pixel_line[0] & 1) > 0), tmp_glyph.pixel_line[0],
-				((tmp_glyph.pixel_line[1] & 16) > 0), ((tmp_glyph.pixel_line[1] & 8) > 0), ((tmp_glyph.pixel_line[1] & 4) > 0), ((tmp_glyph.pixel_line[1] & 2) > 0), ((tmp_glyph.pixel_line[1] & 1) > 0), tmp_glyph.pixel_line[1],
-				((tmp_glyph.pixel_line[2] & 16) > 0), ((tmp_glyph.pixel_line[2] & 8) > 0), ((tmp_glyph.pixel_line[2] & 4) > 0), ((tmp_glyph.pixel_line[2] & 2) > 0), ((tmp_glyph.pixel_line[2] & 1) > 0), tmp_glyph.pixel_line[2],
-				((tmp_glyph.pixel_line[3] & 16) > 0), ((tmp_glyph.pixel_line[3] & 8) > 0), ((tmp_glyph.pixel_line[3] & 4) > 0), ((tmp_glyph.pixel_line[3] & 2) > 0), ((tmp_glyph.pixel_line[3] & 1) > 0), tmp_glyph.pixel_line[3],
-				((tmp_glyph.pixel_line[4] & 16) > 0), ((tmp_glyph.pixel_line[4] & 8) > 0), ((tmp_glyph.pixel_line[4] & 4) > 0), ((tmp_glyph.pixel_line[4] & 2) > 0), ((tmp_glyph.pixel_line[4] & 1) > 0), tmp_glyph.pixel_line[4],
-				((tmp_glyph.pixel_line[5] & 16) > 0), ((tmp_glyph.pixel_line[5] & 8) > 0), ((tmp_glyph.pixel_line[5] & 4) > 0), ((tmp_glyph.pixel_line[5] & 2) > 0), ((tmp_glyph.pixel_line[5] & 1) > 0), tmp_glyph.pixel_line[5],
-				((tmp_glyph.pixel_line[6] & 16) > 0), ((tmp_glyph.pixel_line[6] & 8) > 0), ((tmp_glyph.pixel_line[6] & 4) > 0), ((tmp_glyph.pixel_line[6] & 2) > 0), ((tmp_glyph.pixel_line[6] & 1) > 0), tmp_glyph.pixel_line[6],
-				((tmp_glyph.pixel_line[7] & 16) > 0), ((tmp_glyph.pixel_line[7] & 8) > 0), ((tmp_glyph.pixel_line[7] & 4) > 0), ((tmp_glyph.pixel_line[7] & 2) > 0), ((tmp_glyph.pixel_line[7] & 1) > 0), tmp_glyph.pixel_line[7]);
+	tmp_len = sprintf(buf, "Glyph %u:\nUpdated: %u\n", tmp_index, data->glyph_updated[tmp_index]);
+	for (i = 0; i < 8; i++) {
+		tmp_line = data->buffer_lcd_ugram.glyph[tmp_index].pixel_line[i];
+		tmp_len += sprintf((buf + tmp_len), GLYPH_PRINT_HEAD GLYPH_PRINT_LINE,
+					((tmp_line & 16) > 0), ((tmp_line & 8) > 0), ((tmp_line & 4) > 0), ((tmp_line & 2) > 0), ((tmp_line & 1) > 0), tmp_line);
+	}
+	tmp_len += sprintf((buf + tmp_len), GLYPH_PRINT_HEAD);
+	return tmp_len;
 }
 
-// SysFS object to display UGRAM glyph 1
-static ssize_t piadagio_fp_get_ugram_glyph1(struct device *dev, struct device_attribute *dev_attr, char * buf) {
-	struct piadagio_fp_glyph tmp_glyph = piadagio_fp_buffer_lcd_ugram.glyph[1];
+// SysFS binary object to read the screen/glyph buffers, laid out as the
+// device memory map (the gap between the screen and glyphs reads as 0)
+static ssize_t piadagio_fp_memory_read(struct file *filp, struct kobject *kobj, struct bin_attribute *attr, char *buf, loff_t off, size_t count) {
+	struct piadagio_fp_data *data = dev_get_drvdata(kobj_to_dev(kobj));
+	unsigned char tmp_memory[PIADAGIOFP_MEMORY_LEN];
 
 	printd("%s\n", __FUNCTION__);
-	// Copy the result back to buf
-	return sprintf(buf, "Glyph 1:\nUpdated: %u\n" GLYPH_PRINT, piadagio_fp_glyph_updated[1],
-				((tmp_glyph.pixel_line[0] & 16) > 0), ((tmp_glyph.pixel_line[0] & 8) > 0), ((tmp_glyph.pixel_line[0] & 4) > 0), ((tmp_glyph.pixel_line[0] & 2) > 0), ((tmp_glyph.pixel_line[0] & 1) > 0), tmp_glyph.pixel_line[0],
-				((tmp_glyph.pixel_line[1] & 16) > 0), ((tmp_glyph.pixel_line[1] & 8) > 0), ((tmp_glyph.pixel_line[1] & 4) > 0), ((tmp_glyph.pixel_line[1] & 2) > 0), ((tmp_glyph.pixel_line[1] & 1) > 0), tmp_glyph.pixel_line[1],
-				((tmp_glyph.pixel_line[2] & 16) > 0), ((tmp_glyph.pixel_line[2] & 8) > 0), ((tmp_glyph.pixel_line[2] & 4) > 0), ((tmp_glyph.pixel_line[2] & 2) > 0), ((tmp_glyph.pixel_line[2] & 1) > 0), tmp_glyph.pixel_line[2],
-				((tmp_glyph.pixel_line[3] & 16) > 0), ((tmp_glyph.pixel_line[3] & 8) > 0), ((tmp_glyph.pixel_line[3] & 4) > 0), ((tmp_glyph.pixel_line[3] & 2) > 0), ((tmp_glyph.pixel_line[3] & 1) > 0), tmp_glyph.pixel_line[3],
-				((tmp_glyph.pixel_line[4] & 16) > 0), ((tmp_glyph.pixel_line[4] & 8) > 0), ((tmp_glyph.pixel_line[4] & 4) > 0), ((tmp_glyph.pixel_line[4] & 2) > 0), ((tmp_glyph.pixel_line[4] & 1) > 0), tmp_glyph.pixel_line[4],
-				((tmp_glyph.pixel_line[5] & 16) > 0), ((tmp_glyph.pixel_line[5] & 8) > 0), ((tmp_glyph.pixel_line[5] & 4) > 0), ((tmp_glyph.pixel_line[5] & 2) > 0), ((tmp_glyph.pixel_line[5] & 1) > 0), tmp_glyph.pixel_line[5],
-				((tmp_glyph.pixel_line[6] & 16) > 0), ((tmp_glyph.pixel_line[6] & 8) > 0), ((tmp_glyph.pixel_line[6] & 4) > 0), ((tmp_glyph.pixel_line[6] & 2) > 0), ((tmp_glyph.pixel_line[6] & 1) > 0), tmp_glyph.pixel_line[6],
-				((tmp_glyph.pixel_line[7] & 16) > 0), ((tmp_glyph.pixel_line[7] & 8) > 0), ((tmp_glyph.pixel_line[7] & 4) > 0), ((tmp_glyph.pixel_line[7] & 2) > 0), ((tmp_glyph.pixel_line[7] & 1) > 0), tmp_glyph.pixel_line[7]);
+
+	memset(tmp_memory, 0, PIADAGIOFP_MEMORY_LEN);
+	memcpy(tmp_memory, data->buffer_lcd_screen.chars, SCREEN_BUFFER_LEN);
+	memcpy(&tmp_memory[BUFFER_OFFSET_GLYPH], data->buffer_lcd_ugram.glyph[0].pixel_line, GLYPH_BUFFER_LEN);
+	memcpy(buf, &tmp_memory[off], count);					// sysfs limits off/count to the size
+	return count;
 }
 
-// SysFS object to display UGRAM glyph 2
-static ssize_t piadagio_fp_get_ugram_glyph2(struct device *dev, struct device_attribute *dev_attr, char * buf) {
-	struct piadagio_fp_glyph tmp_glyph = piadagio_fp_buffer_lcd_ugram.glyph[2];
+// SysFS binary object to write the screen/glyph buffers, laid out as the
+// device memory map
+// Only the screen halves and glyphs that change are sent, screen changes
+// are committed (stopping any animation).
+static ssize_t piadagio_fp_memory_write(struct file *filp, struct kobject *kobj, struct bin_attribute *attr, char *buf, loff_t off, size_t count) {
+	struct piadagio_fp_data *data = dev_get_drvdata(kobj_to_dev(kobj));
+	unsigned char tmp_memory[PIADAGIOFP_MEMORY_LEN];
+	bool tmp_glyphs;
+	u8 tmp_halves;
 
 	printd("%s\n", __FUNCTION__);
-	// Copy the result back to buf
-	return sprintf(buf, "Glyph 2:\nUpdated: %u\n" GLYPH_PRINT, piadagio_fp_glyph_updated[2],
-				((tmp_glyph.pixel_line[0] & 16) > 0), ((tmp_glyph.pixel_line[0] & 8) > 0), ((tmp_glyph.pixel_line[0] & 4) > 0), ((tmp_glyph.pixel_line[0] & 2) > 0), ((tmp_glyph.pixel_line[0] & 1) > 0), tmp_glyph.pixel_line[0],
-				((tmp_glyph.pixel_line[1] & 16) > 0), ((tmp_glyph.pixel_line[1] & 8) > 0), ((tmp_glyph.pixel_line[1] & 4) > 0), ((tmp_glyph.pixel_line[1] & 2) > 0), ((tmp_glyph.pixel_line[1] & 1) > 0), tmp_glyph.pixel_line[1],
-				((tmp_glyph.pixel_line[2] & 16) > 0), ((tmp_glyph.pixel_line[2] & 8) > 0), ((tmp_glyph.pixel_line[2] & 4) > 0), ((tmp_glyph.pixel_line[2] & 2) > 0), ((tmp_glyph.pixel_line[2] & 1) > 0), tmp_glyph.pixel_line[2],
-				((tmp_glyph.pixel_line[3] & 16) > 0), ((tmp_glyph.pixel_line[3] & 8) > 0), ((tmp_glyph.pixel_line[3] & 4) > 0), ((tmp_glyph.pixel_line[3] & 2) > 0), ((tmp_glyph.pixel_line[3] & 1) > 0), tmp_glyph.pixel_line[3],
-				((tmp_glyph.pixel_line[4] & 16) > 0), ((tmp_glyph.pixel_line[4] & 8) > 0), ((tmp_glyph.pixel_line[4] & 4) > 0), ((tmp_glyph.pixel_line[4] & 2) > 0), ((tmp_glyph.pixel_line[4] & 1) > 0), tmp_glyph.pixel_line[4],
-				((tmp_glyph.pixel_line[5] & 16) > 0), ((tmp_glyph.pixel_line[5] & 8) > 0), ((tmp_glyph.pixel_line[5] & 4) > 0), ((tmp_glyph.pixel_line[5] & 2) > 0), ((tmp_glyph.pixel_line[5] & 1) > 0), tmp_glyph.pixel_line[5],
-				((tmp_glyph.pixel_line[6] & 16) > 0), ((tmp_glyph.pixel_line[6] & 8) > 0), ((tmp_glyph.pixel_line[6] & 4) > 0), ((tmp_glyph.pixel_line[6] & 2) > 0), ((tmp_glyph.pixel_line[6] & 1) > 0), tmp_glyph.pixel_line[6],
-				((tmp_glyph.pixel_line[7] & 16) > 0), ((tmp_glyph.pixel_line[7] & 8) > 0), ((tmp_glyph.pixel_line[7] & 4) > 0), ((tmp_glyph.pixel_line[7] & 2) > 0), ((tmp_glyph.pixel_line[7] & 1) > 0), tmp_glyph.pixel_line[7]);
-}
 
-// SysFS object to display UGRAM glyph 3
-static ssize_t piadagio_fp_get_ugram_glyph3(struct device *dev, struct device_attribute *dev_attr, char * buf) {
-	struct piadagio_fp_glyph tmp_glyph = piadagio_fp_buffer_lcd_ugram.glyph[3];
+	memcpy(tmp_memory, data->buffer_lcd_screen.chars, SCREEN_BUFFER_LEN);
+	memcpy(&tmp_memory[BUFFER_OFFSET_GLYPH], data->buffer_lcd_ugram.glyph[0].pixel_line, GLYPH_BUFFER_LEN);
+	memcpy(&tmp_memory[off], buf, count);
+
+	tmp_glyphs = piadagio_fp_glyph_update(&data->buffer_lcd_ugram, data->glyph_updated, &tmp_memory[BUFFER_OFFSET_GLYPH]);
+	tmp_halves = piadagio_fp_screen_diff(&data->geometry, &data->buffer_lcd_screen, tmp_memory);
+	if (tmp_halves) {
+		piadagio_fp_anim_stop(data);
+		memcpy(data->buffer_lcd_screen.chars, tmp_memory, SCREEN_BUFFER_LEN);
+		data->canvas_active = false;
+		piadagio_fp_frame_queue(data);
+	} else if (tmp_glyphs) {
+		piadagio_fp_activity(data);
+		if (!READ_ONCE(data->wq_kill)) {
+			mod_delayed_work(data->wq, &data->wq_task_lcd, 0);
+		}
+	}
+	return count;
+}
 
+// SysFS object to display the online LED status
+static ssize_t piadagio_fp_get_led_online(struct device *dev, struct device_attribute *dev_attr, char * buf) {
+	struct piadagio_fp_data *data = dev_get_drvdata(dev);
 	printd("%s\n", __FUNCTION__);
 	// Copy the result back to buf
-	return sprintf(buf, "Glyph 3:\nUpdated: %u\n" GLYPH_PRINT, piadagio_fp_glyph_updated[3],
-				((tmp_glyph.pixel_line[0] & 16) > 0), ((tmp_glyph.pixel_line[0] & 8) > 0), ((tmp_glyph.pixel_line[0] & 4) > 0), ((tmp_glyph.pixel_line[0] & 2) > 0), ((tmp_glyph.pixel_line[0] & 1) > 0), tmp_glyph.pixel_line[0],
-				((tmp_glyph.pixel_line[1] & 16) > 0), ((tmp_glyph.pixel_line[1] & 8) > 0), ((tmp_glyph.pixel_line[1] & 4) > 0), ((tmp_glyph.pixel_line[1] & 2) > 0), ((tmp_glyph.pixel_line[1] & 1) > 0), tmp_glyph.pixel_line[1],
-				((tmp_glyph.pixel_line[2] & 16) > 0), ((tmp_glyph.pixel_line[2] & 8) > 0), ((tmp_glyph.pixel_line[2] & 4) > 0), ((tmp_glyph.pixel_line[2] & 2) > 0), ((tmp_glyph.pixel_line[2] & 1) > 0), tmp_glyph.pixel_line[2],
-				((tmp_glyph.pixel_line[3] & 16) > 0), ((tmp_glyph.pixel_line[3] & 8) > 0), ((tmp_glyph.pixel_line[3] & 4) > 0), ((tmp_glyph.pixel_line[3] & 2) > 0), ((tmp_glyph.pixel_line[3] & 1) > 0), tmp_glyph.pixel_line[3],
-				((tmp_glyph.pixel_line[4] & 16) > 0), ((tmp_glyph.pixel_line[4] & 8) > 0), ((tmp_glyph.pixel_line[4] & 4) > 0), ((tmp_glyph.pixel_line[4] & 2) > 0), ((tmp_glyph.pixel_line[4] & 1) > 0), tmp_glyph.pixel_line[4],
-				((tmp_glyph.pixel_line[5] & 16) > 0), ((tmp_glyph.pixel_line[5] & 8) > 0), ((tmp_glyph.pixel_line[5] & 4) > 0), ((tmp_glyph.pixel_line[5] & 2) > 0), ((tmp_glyph.pixel_line[5] & 1) > 0), tmp_glyph.pixel_line[5],
-				((tmp_glyph.pixel_line[6] & 16) > 0), ((tmp_glyph.pixel_line[6] & 8) > 0), ((tmp_glyph.pixel_line[6] & 4) > 0), ((tmp_glyph.pixel_line[6] & 2) > 0), ((tmp_glyph.pixel_line[6] & 1) > 0), tmp_glyph.pixel_line[6],
-				((tmp_glyph.pixel_line[7] & 16) > 0), ((tmp_glyph.pixel_line[7] & 8) > 0), ((tmp_glyph.pixel_line[7] & 4) > 0), ((tmp_glyph.pixel_line[7] & 2) > 0), ((tmp_glyph.pixel_line[7] & 1) > 0), tmp_glyph.pixel_line[7]);
+	return sprintf(buf, "Online LED: %u\n", data->led_online);
 }
 
-// SysFS object to display UGRAM glyph 4
-static ssize_t piadagio_fp_get_ugram_glyph4(struct device *dev, struct device_attribute *dev_attr, char * buf) {
-	struct piadagio_fp_glyph tmp_glyph = piadagio_fp_buffer_lcd_ugram.glyph[4];
+// SysFS object to set the online LED status
+static ssize_t piadagio_fp_set_led_online(struct device *dev, struct device_attribute * devattr, const char * buf, size_t count) {
+	struct piadagio_fp_data *data = dev_get_drvdata(dev);
+	int value, err;
+	printd("%s\n", __FUNCTION__);
+	err = kstrtoint(buf, 10, &value);
+	if (err < 0) {
+		return err;
+	} else {
+		data->led_online = value;
+		if (!READ_ONCE(data->wq_kill)) {
+			mod_delayed_work(data->wq, &data->wq_task_led, 0);
+		}
+	}
+	return count;
+}
 
+// SysFS object to display the power LED status
+static ssize_t piadagio_fp_get_led_power(struct device *dev, struct device_attribute *dev_attr, char * buf) {
+	struct piadagio_fp_data *data = dev_get_drvdata(dev);
 	printd("%s\n", __FUNCTION__);
 	// Copy the result back to buf
-	return sprintf(buf, "Glyph 4:\nUpdated: %u\n" GLYPH_PRINT, piadagio_fp_glyph_updated[4],
-				((tmp_glyph.pixel_line[0] & 16) > 0), ((tmp_glyph.pixel_line[0] & 8) > 0), ((tmp_glyph.pixel_line[0] & 4) > 0), ((tmp_glyph.pixel_line[0] & 2) > 0), ((tmp_glyph.pixel_line[0] & 1) > 0), tmp_glyph.pixel_line[0],
-				((tmp_glyph.pixel_line[1] & 16) > 0), ((tmp_glyph.pixel_line[1] & 8) > 0), ((tmp_glyph.pixel_line[1] & 4) > 0), ((tmp_glyph.pixel_line[1] & 2) > 0), ((tmp_glyph.pixel_line[1] & 1) > 0), tmp_glyph.pixel_line[1],
-				((tmp_glyph.pixel_line[2] & 16) > 0), ((tmp_glyph.pixel_line[2] & 8) > 0), ((tmp_glyph.pixel_line[2] & 4) > 0), ((tmp_glyph.pixel_line[2] & 2) > 0), ((tmp_glyph.pixel_line[2] & 1) > 0), tmp_glyph.pixel_line[2],
-				((tmp_glyph.pixel_line[3] & 16) > 0), ((tmp_glyph.pixel_line[3] & 8) > 0), ((tmp_glyph.pixel_line[3] & 4) > 0), ((tmp_glyph.pixel_line[3] & 2) > 0), ((tmp_glyph.pixel_line[3] & 1) > 0), tmp_glyph.pixel_line[3],
-				((tmp_glyph.pixel_line[4] & 16) > 0), ((tmp_glyph.pixel_line[4] & 8) > 0), ((tmp_glyph.pixel_line[4] & 4) > 0), ((tmp_glyph.pixel_line[4] & 2) > 0), ((tmp_glyph.pixel_line[4] & 1) > 0), tmp_glyph.pixel_line[4],
-				((tmp_glyph.pixel_line[5] & 16) > 0), ((tmp_glyph.pixel_line[5] & 8) > 0), ((tmp_glyph.pixel_line[5] & 4) > 0), ((tmp_glyph.pixel_line[5] & 2) > 0), ((tmp_glyph.pixel_line[5] & 1) > 0), tmp_glyph.pixel_line[5],
-				((tmp_glyph.pixel_line[6] & 16) > 0), ((tmp_glyph.pixel_line[6] & 8) > 0), ((tmp_glyph.pixel_line[6] & 4) > 0), ((tmp_glyph.pixel_line[6] & 2) > 0), ((tmp_glyph.pixel_line[6] & 1) > 0), tmp_glyph.pixel_line[6],
-				((tmp_glyph.pixel_line[7] & 16) > 0), ((tmp_glyph.pixel_line[7] & 8) > 0), ((tmp_glyph.pixel_line[7] & 4) > 0), ((tmp_glyph.pixel_line[7] & 2) > 0), ((tmp_glyph.pixel_line[7] & 1) > 0), tmp_glyph.pixel_line[7]);
+	return sprintf(buf, "Power LED: %u\n", data->led_power);
 }
 
-// SysFS object to display UGRAM glyph 5
-static ssize_t piadagio_fp_get_ugram_glyph5(struct device *dev, struct device_attribute *dev_attr, char * buf) {
-	struct piadagio_fp_glyph tmp_glyph = piadagio_fp_buffer_lcd_ugram.glyph[5];
+// SysFS object to set the power LED status
+static ssize_t piadagio_fp_set_led_power(struct device *dev, struct device_attribute * devattr, const char * buf, size_t count) {
+	struct piadagio_fp_data *data = dev_get_drvdata(dev);
+	int value, err;
+	printd("%s\n", __FUNCTION__);
+	err = kstrtoint(buf, 10, &value);
+	if (err < 0) {
+		return err;
+	} else {
+		data->led_power = value;
+		if (!READ_ONCE(data->wq_kill)) {
+			mod_delayed_work(data->wq, &data->wq_task_led, 0);
+		}
+	}
+	return count;
+}
 
+// SysFS object to display the maximum frame rate
+static ssize_t piadagio_fp_get_max_fps(struct device *dev, struct device_attribute *dev_attr, char * buf) {
+	struct piadagio_fp_data *data = dev_get_drvdata(dev);
 	printd("%s\n", __FUNCTION__);
-	// Copy the result back to buf
-	return sprintf(buf, "Glyph 5:\nUpdated: %u\n" GLYPH_PRINT, piadagio_fp_glyph_updated[5],
-				((tmp_glyph.pixel_line[0] & 16) > 0), ((tmp_glyph.pixel_line[0] & 8) > 0), ((tmp_glyph.pixel_line[0] & 4) > 0), ((tmp_glyph.pixel_line[0] & 2) > 0), ((tmp_glyph.pixel_line[0] & 1) > 0), tmp_glyph.pixel_line[0],
-				((tmp_glyph.pixel_line[1] & 16) > 0), ((tmp_glyph.pixel_line[1] & 8) > 0), ((tmp_glyph.pixel_line[1] & 4) > 0), ((tmp_glyph.pixel_line[1] & 2) > 0), ((tmp_glyph.pixel_line[1] & 1) > 0), tmp_glyph.pixel_line[1],
-				((tmp_glyph.pixel_line[2] & 16) > 0), ((tmp_glyph.pixel_line[2] & 8) > 0), ((tmp_glyph.pixel_line[2] & 4) > 0), ((tmp_glyph.pixel_line[2] & 2) > 0), ((tmp_glyph.pixel_line[2] & 1) > 0), tmp_glyph.pixel_line[2],
-				((tmp_glyph.pixel_line[3] & 16) > 0), ((tmp_glyph.pixel_line[3] & 8) > 0), ((tmp_glyph.pixel_line[3] & 4) > 0), ((tmp_glyph.pixel_line[3] & 2) > 0), ((tmp_glyph.pixel_line[3] & 1) > 0), tmp_glyph.pixel_line[3],
-				((tmp_glyph.pixel_line[4] & 16) > 0), ((tmp_glyph.pixel_line[4] & 8) > 0), ((tmp_glyph.pixel_line[4] & 4) > 0), ((tmp_glyph.pixel_line[4] & 2) > 0), ((tmp_glyph.pixel_line[4] & 1) > 0), tmp_glyph.pixel_line[4],
-				((tmp_glyph.pixel_line[5] & 16) > 0), ((tmp_glyph.pixel_line[5] & 8) > 0), ((tmp_glyph.pixel_line[5] & 4) > 0), ((tmp_glyph.pixel_line[5] & 2) > 0), ((tmp_glyph.pixel_line[5] & 1) > 0), tmp_glyph.pixel_line[5],
-				((tmp_glyph.pixel_line[6] & 16) > 0), ((tmp_glyph.pixel_line[6] & 8) > 0), ((tmp_glyph.pixel_line[6] & 4) > 0), ((tmp_glyph.pixel_line[6] & 2) > 0), ((tmp_glyph.pixel_line[6] & 1) > 0), tmp_glyph.pixel_line[6],
-				((tmp_glyph.pixel_line[7] & 16) > 0), ((tmp_glyph.pixel_line[7] & 8) > 0), ((tmp_glyph.pixel_line[7] & 4) > 0), ((tmp_glyph.pixel_line[7] & 2) > 0), ((tmp_glyph.pixel_line[7] & 1) > 0), tmp_glyph.pixel_line[7]);
+	return sprintf(buf, "Max FPS: %u\n", data->frame_max_fps);
 }
 
-// SysFS object to display UGRAM glyph 6
-static ssize_t piadagio_fp_get_ugram_glyph6(struct device *dev, struct device_attribute *dev_attr, char * buf) {
-	struct piadagio_fp_glyph tmp_glyph = piadagio_fp_buffer_lcd_ugram.glyph[6];
+// SysFS object to set the maximum frame rate (0 is uncapped)
+static ssize_t piadagio_fp_set_max_fps(struct device *dev, struct device_attribute * devattr, const char * buf, size_t count) {
+	struct piadagio_fp_data *data = dev_get_drvdata(dev);
+	unsigned int value;
+	int err;
+	printd("%s\n", __FUNCTION__);
+	err = kstrtouint(buf, 10, &value);
+	if (err < 0) {
+		return err;
+	} else {
+		piadagio_fp_frame_set_max_fps(data, value);
+	}
+	return count;
+}
 
+// SysFS object to display the idle state
+static ssize_t piadagio_fp_get_idle(struct device *dev, struct device_attribute *dev_attr, char * buf) {
+	struct piadagio_fp_data *data = dev_get_drvdata(dev);
 	printd("%s\n", __FUNCTION__);
-	// Copy the result back to buf
-	return sprintf(buf, "Glyph 6:\nUpdated: %u\n" GLYPH_PRINT, piadagio_fp_glyph_updated[6],
-				((tmp_glyph.pixel_line[0] & 16) > 0), ((tmp_glyph.pixel_line[0] & 8) > 0), ((tmp_glyph.pixel_line[0] & 4) > 0), ((tmp_glyph.pixel_line[0] & 2) > 0), ((tmp_glyph.pixel_line[0] & 1) > 0), tmp_glyph.pixel_line[0],
-				((tmp_glyph.pixel_line[1] & 16) > 0), ((tmp_glyph.pixel_line[1] & 8) > 0), ((tmp_glyph.pixel_line[1] & 4) > 0), ((tmp_glyph.pixel_line[1] & 2) > 0), ((tmp_glyph.pixel_line[1] & 1) > 0), tmp_glyph.pixel_line[1],
-				((tmp_glyph.pixel_line[2] & 16) > 0), ((tmp_glyph.pixel_line[2] & 8) > 0), ((tmp_glyph.pixel_line[2] & 4) > 0), ((tmp_glyph.pixel_line[2] & 2) > 0), ((tmp_glyph.pixel_line[2] & 1) > 0), tmp_glyph.pixel_line[2],
-				((tmp_glyph.pixel_line[3] & 16) > 0), ((tmp_glyph.pixel_line[3] & 8) > 0), ((tmp_glyph.pixel_line[3] & 4) > 0), ((tmp_glyph.pixel_line[3] & 2) > 0), ((tmp_glyph.pixel_line[3] & 1) > 0), tmp_glyph.pixel_line[3],
-				((tmp_glyph.pixel_line[4] & 16) > 0), ((tmp_glyph.pixel_line[4] & 8) > 0), ((tmp_glyph.pixel_line[4] & 4) > 0), ((tmp_glyph.pixel_line[4] & 2) > 0), ((tmp_glyph.pixel_line[4] & 1) > 0), tmp_glyph.pixel_line[4],
-				((tmp_glyph.pixel_line[5] & 16) > 0), ((tmp_glyph.pixel_line[5] & 8) > 0), ((tmp_glyph.pixel_line[5] & 4) > 0), ((tmp_glyph.pixel_line[5] & 2) > 0), ((tmp_glyph.pixel_line[5] & 1) > 0), tmp_glyph.pixel_line[5],
-				((tmp_glyph.pixel_line[6] & 16) > 0), ((tmp_glyph.pixel_line[6] & 8) > 0), ((tmp_glyph.pixel_line[6] & 4) > 0), ((tmp_glyph.pixel_line[6] & 2) > 0), ((tmp_glyph.pixel_line[6] & 1) > 0), tmp_glyph.pixel_line[6],
-				((tmp_glyph.pixel_line[7] & 16) > 0), ((tmp_glyph.pixel_line[7] & 8) > 0), ((tmp_glyph.pixel_line[7] & 4) > 0), ((tmp_glyph.pixel_line[7] & 2) > 0), ((tmp_glyph.pixel_line[7] & 1) > 0), tmp_glyph.pixel_line[7]);
+	return sprintf(buf, "Idle: %u\n", data->idle);
 }
 
-// SysFS object to display UGRAM glyph 7
-static ssize_t piadagio_fp_get_ugram_glyph7(struct device *dev, struct device_attribute *dev_attr, char * buf) {
-	struct piadagio_fp_glyph tmp_glyph = piadagio_fp_buffer_lcd_ugram.glyph[7];
+// SysFS object to display the idle timeout
+static ssize_t piadagio_fp_get_idle_timeout(struct device *dev, struct device_attribute *dev_attr, char * buf) {
+	struct piadagio_fp_data *data = dev_get_drvdata(dev);
+	printd("%s\n", __FUNCTION__);
+	return sprintf(buf, "Idle timeout (ms): %u\n", data->idle_timeout);
+}
 
+// SysFS object to set the idle timeout (ms, 0 disables)
+static ssize_t piadagio_fp_set_idle_timeout(struct device *dev, struct device_attribute * devattr, const char * buf, size_t count) {
+	struct piadagio_fp_data *data = dev_get_drvdata(dev);
+	unsigned int value;
+	int err;
 	printd("%s\n", __FUNCTION__);
-	// Copy the result back to buf
-	return sprintf(buf, "Glyph 7:\nUpdated: %u\n" GLYPH_PRINT, piadagio_fp_glyph_updated[7],
-				((tmp_glyph.pixel_line[0] & 16) > 0), ((tmp_glyph.pixel_line[0] & 8) > 0), ((tmp_glyph.pixel_line[0] & 4) > 0), ((tmp_glyph.pixel_line[0] & 2) > 0), ((tmp_glyph.pixel_line[0] & 1) > 0), tmp_glyph.pixel_line[0],
-				((tmp_glyph.pixel_line[1] & 16) > 0), ((tmp_glyph.pixel_line[1] & 8) > 0), ((tmp_glyph.pixel_line[1] & 4) > 0), ((tmp_glyph.pixel_line[1] & 2) > 0), ((tmp_glyph.pixel_line[1] & 1) > 0), tmp_glyph.pixel_line[1],
-				((tmp_glyph.pixel_line[2] & 16) > 0), ((tmp_glyph.pixel_line[2] & 8) > 0), ((tmp_glyph.pixel_line[2] & 4) > 0), ((tmp_glyph.pixel_line[2] & 2) > 0), ((tmp_glyph.pixel_line[2] & 1) > 0), tmp_glyph.pixel_line[2],
-				((tmp_glyph.pixel_line[3] & 16) > 0), ((tmp_glyph.pixel_line[3] & 8) > 0), ((tmp_glyph.pixel_line[3] & 4) > 0), ((tmp_glyph.pixel_line[3] & 2) > 0), ((tmp_glyph.pixel_line[3] & 1) > 0), tmp_glyph.pixel_line[3],
-				((tmp_glyph.pixel_line[4] & 16) > 0), ((tmp_glyph.pixel_line[4] & 8) > 0), ((tmp_glyph.pixel_line[4] & 4) > 0), ((tmp_glyph.pixel_line[4] & 2) > 0), ((tmp_glyph.pixel_line[4] & 1) > 0), tmp_glyph.pixel_line[4],
-				((tmp_glyph.pixel_line[5] & 16) > 0), ((tmp_glyph.pixel_line[5] & 8) > 0), ((tmp_glyph.pixel_line[5] & 4) > 0), ((tmp_glyph.pixel_line[5] & 2) > 0), ((tmp_glyph.pixel_line[5] & 1) > 0), tmp_glyph.pixel_line[5],
-				((tmp_glyph.pixel_line[6] & 16) > 0), ((tmp_glyph.pixel_line[6] & 8) > 0), ((tmp_glyph.pixel_line[6] & 4) > 0), ((tmp_glyph.pixel_line[6] & 2) > 0), ((tmp_glyph.pixel_line[6] & 1) > 0), tmp_glyph.pixel_line[6],
-				((tmp_glyph.pixel_line[7] & 16) > 0), ((tmp_glyph.pixel_line[7] & 8) > 0), ((tmp_glyph.pixel_line[7] & 4) > 0), ((tmp_glyph.pixel_line[7] & 2) > 0), ((tmp_glyph.pixel_line[7] & 1) > 0), tmp_glyph.pixel_line[7]);
+	err = kstrtouint(buf, 10, &value);
+	if (err < 0) {
+		return err;
+	} else {
+		data->idle_timeout = value;
+		piadagio_fp_activity(data);
+	}
+	return count;
 }
 
-// SysFS object to display the online LED status
-static ssize_t piadagio_fp_get_led_online(struct device *dev, struct device_attribute *dev_attr, char * buf) {
+// SysFS object to display whether the display is blanked when idle
+static ssize_t piadagio_fp_get_idle_blank(struct device *dev, struct device_attribute *dev_attr, char * buf) {
+	struct piadagio_fp_data *data = dev_get_drvdata(dev);
 	printd("%s\n", __FUNCTION__);
-	// Copy the result back to buf
-	return sprintf(buf, "Online LED: %u\n", piadagio_fp_led_online);
+	return sprintf(buf, "Idle blank: %u\n", data->idle_blank);
 }
 
-// SysFS object to set the online LED status
-static ssize_t piadagio_fp_set_led_online(struct device *dev, struct device_attribute * devattr, const char * buf, size_t count) {
+// SysFS object to set whether the display is blanked when idle
+static ssize_t piadagio_fp_set_idle_blank(struct device *dev, struct device_attribute * devattr, const char * buf, size_t count) {
+	struct piadagio_fp_data *data = dev_get_drvdata(dev);
 	int value, err;
 	printd("%s\n", __FUNCTION__);
 	err = kstrtoint(buf, 10, &value);
 	if (err < 0) {
 		return err;
 	} else {
-		piadagio_fp_led_online = value;
+		data->idle_blank = (value > 0);
 	}
 	return count;
 }
 
-// SysFS object to display the power LED status
-static ssize_t piadagio_fp_get_led_power(struct device *dev, struct device_attribute *dev_attr, char * buf) {
+// SysFS object to display the button debounce time
+static ssize_t piadagio_fp_get_button_debounce(struct device *dev, struct device_attribute *dev_attr, char * buf) {
+	struct piadagio_fp_data *data = dev_get_drvdata(dev);
 	printd("%s\n", __FUNCTION__);
-	// Copy the result back to buf
-	return sprintf(buf, "Power LED: %u\n", piadagio_fp_led_power);
+	return sprintf(buf, "Button debounce (ms): %u\n", data->button.debounce);
 }
 
-// SysFS object to set the power LED status
-static ssize_t piadagio_fp_set_led_power(struct device *dev, struct device_attribute * devattr, const char * buf, size_t count) {
-	int value, err;
+// SysFS object to set the button debounce time
+static ssize_t piadagio_fp_set_button_debounce(struct device *dev, struct device_attribute * devattr, const char * buf, size_t count) {
+	struct piadagio_fp_data *data = dev_get_drvdata(dev);
+	unsigned int value;
+	int err;
 	printd("%s\n", __FUNCTION__);
-	err = kstrtoint(buf, 10, &value);
+	err = kstrtouint(buf, 10, &value);
+	if (err < 0) {
+		return err;
+	} else {
+		data->button.debounce = value;
+	}
+	return count;
+}
+
+// SysFS object to display the button long press time
+static ssize_t piadagio_fp_get_button_long(struct device *dev, struct device_attribute *dev_attr, char * buf) {
+	struct piadagio_fp_data *data = dev_get_drvdata(dev);
+	printd("%s\n", __FUNCTION__);
+	return sprintf(buf, "Button long press (ms): %u\n", data->button.long_press);
+}
+
+// SysFS object to set the button long press time
+static ssize_t piadagio_fp_set_button_long(struct device *dev, struct device_attribute * devattr, const char * buf, size_t count) {
+	struct piadagio_fp_data *data = dev_get_drvdata(dev);
+	unsigned int value;
+	int err;
+	printd("%s\n", __FUNCTION__);
+	err = kstrtouint(buf, 10, &value);
+	if (err < 0) {
+		return err;
+	} else {
+		data->button.long_press = value;
+	}
+	return count;
+}
+
+// SysFS object to display the button repeat interval
+static ssize_t piadagio_fp_get_button_repeat(struct device *dev, struct device_attribute *dev_attr, char * buf) {
+	struct piadagio_fp_data *data = dev_get_drvdata(dev);
+	printd("%s\n", __FUNCTION__);
+	return sprintf(buf, "Button repeat (ms): %u\n", data->button.repeat);
+}
+
+// SysFS object to set the button repeat interval
+static ssize_t piadagio_fp_set_button_repeat(struct device *dev, struct device_attribute * devattr, const char * buf, size_t count) {
+	struct piadagio_fp_data *data = dev_get_drvdata(dev);
+	unsigned int value;
+	int err;
+	printd("%s\n", __FUNCTION__);
+	err = kstrtouint(buf, 10, &value);
 	if (err < 0) {
 		return err;
 	} else {
-		piadagio_fp_led_power = value;
+		data->button.repeat = value;
+	}
+	return count;
+}
+
+// SysFS object to draw big text
+// Takes '<line> <column> <text>', e.g. '1 2 12:34'
+static ssize_t piadagio_fp_set_big_text(struct device *dev, struct device_attribute * devattr, const char * buf, size_t count) {
+	struct piadagio_fp_data *data = dev_get_drvdata(dev);
+	char tmp_text[PIADAGIOFP_BIG_TEXT_LEN + 1];
+	unsigned int tmp_row, tmp_col;
+	int tmp_offset = 0, err;
+	printd("%s\n", __FUNCTION__);
+	if ((sscanf(buf, "%u %u %n", &tmp_row, &tmp_col, &tmp_offset) < 2) || (tmp_offset == 0)) {
+		return -EINVAL;
+	}
+	strscpy(tmp_text, (buf + tmp_offset), sizeof(tmp_text));
+	err = piadagio_fp_big_text(data, tmp_row, tmp_col, strim(tmp_text), PIADAGIOFP_BIG_TEXT_LEN);
+	if (err < 0) {
+		return err;
+	}
+	return count;
+}
+
+// SysFS object to display the glyph bank
+static ssize_t piadagio_fp_get_glyph_bank(struct device *dev, struct device_attribute *dev_attr, char * buf) {
+	struct piadagio_fp_data *data = dev_get_drvdata(dev);
+	ssize_t retval;
+	printd("%s\n", __FUNCTION__);
+	mutex_lock(&data->bank_lock);
+	retval = sprintf(buf, "Glyph bank: %s\n", ((data->bank_name[0] != 0) ? data->bank_name : "None"));
+	mutex_unlock(&data->bank_lock);
+	return retval;
+}
+
+// SysFS object to select the glyph bank (by name)
+static ssize_t piadagio_fp_set_glyph_bank(struct device *dev, struct device_attribute * devattr, const char * buf, size_t count) {
+	struct piadagio_fp_data *data = dev_get_drvdata(dev);
+	char tmp_name[PIADAGIOFP_BANK_NAME_LEN];
+	int err;
+	printd("%s\n", __FUNCTION__);
+	strscpy(tmp_name, buf, sizeof(tmp_name));
+	err = piadagio_fp_bank_load(data, strim(tmp_name));
+	if (err < 0) {
+		return err;
+	}
+	return count;
+}
+
+// SysFS object to display the canvas viewport
+static ssize_t piadagio_fp_get_viewport(struct device *dev, struct device_attribute *dev_attr, char * buf) {
+	struct piadagio_fp_data *data = dev_get_drvdata(dev);
+	printd("%s\n", __FUNCTION__);
+	return sprintf(buf, "Viewport: %u%s\n", data->canvas_viewport, (data->canvas_active ? "" : " (inactive)"));
+}
+
+// SysFS object to set the canvas viewport (first canvas line shown)
+static ssize_t piadagio_fp_set_viewport(struct device *dev, struct device_attribute * devattr, const char * buf, size_t count) {
+	struct piadagio_fp_data *data = dev_get_drvdata(dev);
+	unsigned int value;
+	int err;
+	printd("%s\n", __FUNCTION__);
+	err = kstrtouint(buf, 10, &value);
+	if (err < 0) {
+		return err;
+	}
+	err = piadagio_fp_frame_set_viewport(data, value);
+	if (err < 0) {
+		return err;
+	}
+	return count;
+}
+
+// SysFS object to display the write mode
+static ssize_t piadagio_fp_get_write_mode(struct device *dev, struct device_attribute *dev_attr, char * buf) {
+	struct piadagio_fp_data *data = dev_get_drvdata(dev);
+	printd("%s\n", __FUNCTION__);
+	return sprintf(buf, "Write mode: %u (%s)\n", data->write_mode, ((data->write_mode == PIADAGIOFP_WRITE_TEXT) ? "text" : "buffer"));
+}
+
+// SysFS object to set the write mode
+static ssize_t piadagio_fp_set_write_mode_attr(struct device *dev, struct device_attribute * devattr, const char * buf, size_t count) {
+	struct piadagio_fp_data *data = dev_get_drvdata(dev);
+	unsigned int value;
+	int err;
+	printd("%s\n", __FUNCTION__);
+	err = kstrtouint(buf, 10, &value);
+	if (err < 0) {
+		return err;
+	}
+	err = piadagio_fp_set_write_mode(data, value);
+	if (err < 0) {
+		return err;
 	}
 	return count;
 }
@@ -771,19 +2432,36 @@ static ssize_t piadagio_fp_get_version(struct device *dev, struct device_attribu
 static DEVICE_ATTR(fp_command, S_IRUGO, piadagio_fp_get_command, NULL);
 static DEVICE_ATTR(fp_lcd_buffer, S_IRUGO, piadagio_fp_get_lcd_buffer, NULL);
 static DEVICE_ATTR(fp_stats, S_IRUGO, piadagio_fp_get_stats, NULL);
+static DEVICE_ATTR(fp_counters, S_IRUGO, piadagio_fp_get_counters, NULL);
+static DEVICE_ATTR(fp_counters_reset, 0200, NULL, piadagio_fp_set_counters_reset);
+static DEVICE_ATTR(fp_resync, 0200, NULL, piadagio_fp_set_resync);
 static DEVICE_ATTR(fp_do_update, 0644, piadagio_fp_get_do_update, piadagio_fp_set_do_update);
 static DEVICE_ATTR(fp_do_update_screen, 0644, piadagio_fp_get_do_update_screen, piadagio_fp_set_do_update_screen);
 static DEVICE_ATTR(fp_i2c_buffer, S_IRUGO, piadagio_fp_get_i2c_buffer, NULL);
-static DEVICE_ATTR(fp_glyph0, S_IRUGO, piadagio_fp_get_ugram_glyph0, NULL);
-static DEVICE_ATTR(fp_glyph1, S_IRUGO, piadagio_fp_get_ugram_glyph1, NULL);
-static DEVICE_ATTR(fp_glyph2, S_IRUGO, piadagio_fp_get_ugram_glyph2, NULL);
-static DEVICE_ATTR(fp_glyph3, S_IRUGO, piadagio_fp_get_ugram_glyph3, NULL);
-static DEVICE_ATTR(fp_glyph4, S_IRUGO, piadagio_fp_get_ugram_glyph4, NULL);
-static DEVICE_ATTR(fp_glyph5, S_IRUGO, piadagio_fp_get_ugram_glyph5, NULL);
-static DEVICE_ATTR(fp_glyph6, S_IRUGO, piadagio_fp_get_ugram_glyph6, NULL);
-static DEVICE_ATTR(fp_glyph7, S_IRUGO, piadagio_fp_get_ugram_glyph7, NULL);
+#define PIADAGIOFP_GLYPH_ATTR(_index) \
+	static struct dev_ext_attribute dev_attr_fp_glyph##_index = { __ATTR(fp_glyph##_index, S_IRUGO, piadagio_fp_get_ugram_glyph, NULL), (void *) _index }
+PIADAGIOFP_GLYPH_ATTR(0);
+PIADAGIOFP_GLYPH_ATTR(1);
+PIADAGIOFP_GLYPH_ATTR(2);
+PIADAGIOFP_GLYPH_ATTR(3);
+PIADAGIOFP_GLYPH_ATTR(4);
+PIADAGIOFP_GLYPH_ATTR(5);
+PIADAGIOFP_GLYPH_ATTR(6);
+PIADAGIOFP_GLYPH_ATTR(7);
+static BIN_ATTR(fp_memory, 0644, piadagio_fp_memory_read, piadagio_fp_memory_write, PIADAGIOFP_MEMORY_LEN);
 static DEVICE_ATTR(fp_led_online, 0644, piadagio_fp_get_led_online, piadagio_fp_set_led_online);
 static DEVICE_ATTR(fp_led_power, 0644, piadagio_fp_get_led_power, piadagio_fp_set_led_power);
+static DEVICE_ATTR(fp_max_fps, 0644, piadagio_fp_get_max_fps, piadagio_fp_set_max_fps);
+static DEVICE_ATTR(fp_idle, S_IRUGO, piadagio_fp_get_idle, NULL);
+static DEVICE_ATTR(fp_idle_timeout, 0644, piadagio_fp_get_idle_timeout, piadagio_fp_set_idle_timeout);
+static DEVICE_ATTR(fp_idle_blank, 0644, piadagio_fp_get_idle_blank, piadagio_fp_set_idle_blank);
+static DEVICE_ATTR(fp_button_debounce, 0644, piadagio_fp_get_button_debounce, piadagio_fp_set_button_debounce);
+static DEVICE_ATTR(fp_button_long, 0644, piadagio_fp_get_button_long, piadagio_fp_set_button_long);
+static DEVICE_ATTR(fp_button_repeat, 0644, piadagio_fp_get_button_repeat, piadagio_fp_set_button_repeat);
+static DEVICE_ATTR(fp_big_text, 0200, NULL, piadagio_fp_set_big_text);
+static DEVICE_ATTR(fp_glyph_bank, 0644, piadagio_fp_get_glyph_bank, piadagio_fp_set_glyph_bank);
+static DEVICE_ATTR(fp_viewport, 0644, piadagio_fp_get_viewport, piadagio_fp_set_viewport);
+static DEVICE_ATTR(fp_write_mode, 0644, piadagio_fp_get_write_mode, piadagio_fp_set_write_mode_attr);
 static DEVICE_ATTR(fp_version, S_IRUGO, piadagio_fp_get_version, NULL);
 
 ////////////////////////////////////////////////////////////////////
@@ -820,152 +2498,334 @@ static int piadagio_fp_detect(struct i2c_client * client, struct i2c_board_info
 	return 0;
 }
 
+// Called once the char device is removed, and the last file is closed
+static void piadagio_fp_chrdev_release(struct device *dev) {
+	struct piadagio_fp_data *data = container_of(dev, struct piadagio_fp_data, chrdev);
+
+	printd("%s\n", __FUNCTION__);
+
+	kfree(data);
+}
+
 // Device instantiation
 static int piadagio_fp_probe(struct i2c_client *client, const struct i2c_device_id *id) {
-	int retval = 0;
+	int retval = 0, minor;
 	struct device * dev = &client->dev;
 	struct piadagio_fp_data *data = NULL;
+	const char *tmp_bank;
 
 	printd("%s\n", __FUNCTION__);
 
-	piadagio_fp_wq = alloc_ordered_workqueue(PIADAGIOFP_WQ_NAME, 0);
-	if(!piadagio_fp_wq) {
-		return -ENOMEM;
-	}
-
-	/* Allocate the client's data here */
-	data = devm_kzalloc(&client->dev, sizeof(struct piadagio_fp_data), GFP_KERNEL);
+	/* Allocate the client's data here, this isn't devm as an open
+	 * device file can hold it after the client is removed.
+	 */
+	data = kzalloc(sizeof(struct piadagio_fp_data), GFP_KERNEL);
 	if(!data) {
-		retval = -ENOMEM;
-		goto unreg_wq;
+		return -ENOMEM;
 	}
 
 	// Initialize client's data to default
 	i2c_set_clientdata(client, data);
-	// Initialize the mutex
+	data->client = client;
+	// Initialize the mutexes
 	mutex_init(&data->update_lock);
+	mutex_init(&data->open_lock);
+	mutex_init(&data->idle_lock);
+	mutex_init(&data->anim_lock);
+	mutex_init(&data->menu_lock);
+	mutex_init(&data->event_read_lock);
+	mutex_init(&data->bank_lock);
+	init_rwsem(&data->remove_lock);
+	init_waitqueue_head(&data->bank_wait);
+	atomic_set(&data->bank_loads, 0);
+	init_waitqueue_head(&data->event_wait);
+	INIT_KFIFO(data->events);
+	INIT_KFIFO(data->menu_keys);
+	spin_lock_init(&data->frame_lock);
+	init_waitqueue_head(&data->frame_wait);
 
 	/* If our driver requires additional data initialization
 	 * we do it here. For our intents and purposes, we only
 	 * set the data->kind which is taken from the i2c_device_id.
 	 */
 	data->kind = id->driver_data;
-
-	// Store for character driver operations
-	piadagio_fp_i2c_client = client;
+	data->write_to_buffer = BUFFER_WRITE_CHAR;
+	data->i2c_update_do = 1;
+	data->i2c_update_do_screen = 1;
+	data->led_power = 1;
+	piadagio_fp_frame_set_max_fps(data, fp_max_fps);
+	data->idle_timeout = fp_idle_timeout;
+	data->idle_blank = fp_idle_blank;
+	data->lcd_last_updated = jiffies;
+	data->command_last_read = jiffies;
+	data->shadow_resync_last = jiffies;
+	data->frame_last_start = jiffies - data->frame_interval;		// Don't hold the first frame (the splash)
+	data->menu_parent = PIADAGIOFP_MENU_ROOT;
+	data->button.state = PIADAGIOFP_BUTTON_IDLE;
+	data->button.debounce = fp_button_debounce;
+	data->button.long_press = fp_button_long;
+	data->button.repeat = fp_button_repeat;
+
+	// Work out the panel size
+	if (piadagio_fp_geometry_read(data) < 0) {
+		printe("%s: Unsupported panel geometry!\n", __FUNCTION__);
+		retval = -EINVAL;
+		goto free_data;
+	}
 
 	// Clear the lcd buffer
-	piadagio_fp_buffer_lcd_clear();
+	piadagio_fp_buffer_lcd_clear(data);
 
 	// Initialise the lcd ugram buffer
-	piadagio_fp_buffer_ugram_init();
+	piadagio_fp_buffer_ugram_init(data);
+
+	// Fill the buffers with the splash
+	piadagio_fp_splash_init(data);
+
+	// Zero the statistics
+	piadagio_fp_stats_reset(data);
+
+	// Each panel gets it's own (ordered) workqueue, so panels update independently.
+	// It's freezable, so work queued during system suspend (by LED triggers,
+	// glyph bank loads, ...) is held until resume, rather than using the bus.
+	data->wq = alloc_ordered_workqueue("%s-%s", WQ_FREEZABLE, PIADAGIOFP_WQ_NAME, dev_name(dev));
+	if(!data->wq) {
+		retval = -ENOMEM;
+		goto free_data;
+	}
+	INIT_DELAYED_WORK(&data->wq_task_lcd, piadagio_fp_task_lcd_update);
+	INIT_DELAYED_WORK(&data->wq_task_led, piadagio_fp_task_led_update);
+	INIT_DEFERRABLE_WORK(&data->wq_task_idle, piadagio_fp_task_idle_poll);
+	INIT_DELAYED_WORK(&data->wq_task_buttons, piadagio_fp_task_buttons);
+	INIT_WORK(&data->anim_work, piadagio_fp_task_anim);
+	INIT_WORK(&data->menu_work, piadagio_fp_task_menu);
+	hrtimer_init(&data->anim_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	data->anim_timer.function = piadagio_fp_anim_timer;
 
 	// We now create our character device driver
-	piadagio_fp_major = register_chrdev(0, PIADAGIOFP_I2C_DEVNAME, &piadagio_fp_fops);
-	if (piadagio_fp_major < 0) {
-		retval = piadagio_fp_major;
-		printe("%s: Failed to register char device!\n", __FUNCTION__);
+	minor = ida_simple_get(&piadagio_fp_minors, 0, PIADAGIOFP_MAX_DEVICES, GFP_KERNEL);
+	if (minor < 0) {
+		retval = minor;
+		printe("%s: Failed to allocate minor number!\n", __FUNCTION__);
 		goto unreg_wq;
 	}
-
-	piadagio_fp_class = class_create(THIS_MODULE, PIADAGIOFP_I2C_DEVNAME);
-	if (IS_ERR(piadagio_fp_class)) {
-		retval = PTR_ERR(piadagio_fp_class);
-		printe("%s: Failed to create class!\n", __FUNCTION__);
-		goto unreg_chrdev;
-	}
-	piadagio_fp_device = device_create(piadagio_fp_class, NULL,
-						MKDEV(piadagio_fp_major, 0),
-						NULL,
-						PIADAGIOFP_I2C_DEVNAME);
-	if (IS_ERR(piadagio_fp_device)) {
-		retval = PTR_ERR(piadagio_fp_device);
-		printe("%s: Failed to create device!\n", __FUNCTION__);
-		goto unreg_class;
+	data->devt = MKDEV(MAJOR(piadagio_fp_devt), minor);
+
+	// From here on the data is freed by the char device's release
+	device_initialize(&data->chrdev);
+	data->chrdev.class = piadagio_fp_class;
+	data->chrdev.parent = dev;
+	data->chrdev.devt = data->devt;
+	data->chrdev.release = piadagio_fp_chrdev_release;
+	dev_set_drvdata(&data->chrdev, data);
+	// The first panel keeps the original device name
+	if (minor == 0) {
+		retval = dev_set_name(&data->chrdev, PIADAGIOFP_I2C_DEVNAME);
+	} else {
+		retval = dev_set_name(&data->chrdev, PIADAGIOFP_I2C_DEVNAME "%d", minor);
+	}
+	if (retval < 0) {
+		printe("%s: Failed to name device!\n", __FUNCTION__);
+		goto unreg_minor;
 	}
 
-	// Initialize the mutex for /dev fops clients
-	mutex_init(&piadagio_fp_mutex);
+	// The cdev holds a reference to the device while it's open
+	cdev_init(&data->cdev, &piadagio_fp_fops);
+	data->cdev.owner = THIS_MODULE;
+	retval = cdev_device_add(&data->cdev, &data->chrdev);
+	if (retval < 0) {
+		printe("%s: Failed to register char device!\n", __FUNCTION__);
+		goto unreg_minor;
+	}
 
 	// We now register our sysfs attributs.
 	device_create_file(dev, &dev_attr_fp_command);
 	device_create_file(dev, &dev_attr_fp_lcd_buffer);
 	device_create_file(dev, &dev_attr_fp_stats);
+	device_create_file(dev, &dev_attr_fp_counters);
+	device_create_file(dev, &dev_attr_fp_counters_reset);
+	device_create_file(dev, &dev_attr_fp_resync);
 	device_create_file(dev, &dev_attr_fp_do_update);
 	device_create_file(dev, &dev_attr_fp_do_update_screen);
 	device_create_file(dev, &dev_attr_fp_i2c_buffer);
-	device_create_file(dev, &dev_attr_fp_glyph0);
-	device_create_file(dev, &dev_attr_fp_glyph1);
-	device_create_file(dev, &dev_attr_fp_glyph2);
-	device_create_file(dev, &dev_attr_fp_glyph3);
-	device_create_file(dev, &dev_attr_fp_glyph4);
-	device_create_file(dev, &dev_attr_fp_glyph5);
-	device_create_file(dev, &dev_attr_fp_glyph6);
-	device_create_file(dev, &dev_attr_fp_glyph7);
+	device_create_file(dev, &dev_attr_fp_glyph0.attr);
+	device_create_file(dev, &dev_attr_fp_glyph1.attr);
+	device_create_file(dev, &dev_attr_fp_glyph2.attr);
+	device_create_file(dev, &dev_attr_fp_glyph3.attr);
+	device_create_file(dev, &dev_attr_fp_glyph4.attr);
+	device_create_file(dev, &dev_attr_fp_glyph5.attr);
+	device_create_file(dev, &dev_attr_fp_glyph6.attr);
+	device_create_file(dev, &dev_attr_fp_glyph7.attr);
+	device_create_bin_file(dev, &bin_attr_fp_memory);
 	device_create_file(dev, &dev_attr_fp_led_online);
 	device_create_file(dev, &dev_attr_fp_led_power);
+	device_create_file(dev, &dev_attr_fp_max_fps);
+	device_create_file(dev, &dev_attr_fp_idle);
+	device_create_file(dev, &dev_attr_fp_idle_timeout);
+	device_create_file(dev, &dev_attr_fp_idle_blank);
+	device_create_file(dev, &dev_attr_fp_button_debounce);
+	device_create_file(dev, &dev_attr_fp_button_long);
+	device_create_file(dev, &dev_attr_fp_button_repeat);
+	device_create_file(dev, &dev_attr_fp_big_text);
+	device_create_file(dev, &dev_attr_fp_glyph_bank);
+	device_create_file(dev, &dev_attr_fp_viewport);
+	device_create_file(dev, &dev_attr_fp_write_mode);
 	device_create_file(dev, &dev_attr_fp_version);
 
-	// Create the first workqueue task
-	queue_delayed_work(piadagio_fp_wq, &piadagio_fp_wq_task_lcd, 10);
-	queue_delayed_work(piadagio_fp_wq, &piadagio_fp_wq_task_led, 500);
+	// Register the LEDs, so they can be driven by the kernel's LED triggers
+	piadagio_fp_leds_register(data, minor);
+
+	// Load the default glyph bank, the DT property takes precedence
+	if (device_property_read_string(dev, "glyph-bank", &tmp_bank) < 0) {
+		tmp_bank = fp_glyph_bank;
+	}
+	if ((tmp_bank[0] != 0) && (piadagio_fp_bank_load(data, tmp_bank) < 0)) {
+		printe("%s: Failed to request glyph bank '%s'!\n", __FUNCTION__, tmp_bank);
+	}
+
+	// The panel is active (holding a runtime PM reference) until it goes idle
+	pm_runtime_set_active(dev);
+	pm_runtime_get_noresume(dev);
+	pm_runtime_set_autosuspend_delay(dev, fp_idle_poll);
+	pm_runtime_use_autosuspend(dev);
+	pm_runtime_enable(dev);
+
+	// Set the LEDs and show the splash straight away, so they're the
+	// first transactions (glyphs are sent before the screen)
+	queue_delayed_work(data->wq, &data->wq_task_led, 0);
+	piadagio_fp_frame_queue(data);
 
 	return 0;
 
 // Cleanup on failed operations
-unreg_class:
-	class_unregister(piadagio_fp_class);
-	class_destroy(piadagio_fp_class);
-unreg_chrdev:
-	unregister_chrdev(piadagio_fp_major, PIADAGIOFP_I2C_DEVNAME);
+unreg_minor:
+	ida_simple_remove(&piadagio_fp_minors, minor);
+	destroy_workqueue(data->wq);
+	put_device(&data->chrdev);				// Frees data
+	printe("%s: Driver initialization failed!\n", __FUNCTION__);
+	return retval;
 unreg_wq:
-	destroy_workqueue(piadagio_fp_wq);
+	destroy_workqueue(data->wq);
+free_data:
+	kfree(data);
 	printe("%s: Driver initialization failed!\n", __FUNCTION__);
-out:
 	return retval;
 }
 
 // Device removal
 static int piadagio_fp_remove(struct i2c_client * client) {
 	struct device * dev = &client->dev;
+	struct piadagio_fp_data *data = i2c_get_clientdata(client);
 
 	printd("%s\n", __FUNCTION__);
 
-	piadagio_fp_i2c_client = NULL;
+	// Stops the tasks, timers and callbacks requeueing, ahead of the
+	// cancels below
+	WRITE_ONCE(data->wq_kill, true);
+	wake_up_interruptible_all(&data->frame_wait);			// Release any frame waiters
+	wake_up_interruptible_all(&data->event_wait);			// and event readers
 
 	device_remove_file(dev, &dev_attr_fp_command);
 	device_remove_file(dev, &dev_attr_fp_lcd_buffer);
 	device_remove_file(dev, &dev_attr_fp_stats);
+	device_remove_file(dev, &dev_attr_fp_counters);
+	device_remove_file(dev, &dev_attr_fp_counters_reset);
+	device_remove_file(dev, &dev_attr_fp_resync);
 	device_remove_file(dev, &dev_attr_fp_do_update);
 	device_remove_file(dev, &dev_attr_fp_do_update_screen);
 	device_remove_file(dev, &dev_attr_fp_i2c_buffer);
-	device_remove_file(dev, &dev_attr_fp_glyph0);
-	device_remove_file(dev, &dev_attr_fp_glyph1);
-	device_remove_file(dev, &dev_attr_fp_glyph2);
-	device_remove_file(dev, &dev_attr_fp_glyph3);
-	device_remove_file(dev, &dev_attr_fp_glyph4);
-	device_remove_file(dev, &dev_attr_fp_glyph5);
-	device_remove_file(dev, &dev_attr_fp_glyph6);
-	device_remove_file(dev, &dev_attr_fp_glyph7);
+	device_remove_file(dev, &dev_attr_fp_glyph0.attr);
+	device_remove_file(dev, &dev_attr_fp_glyph1.attr);
+	device_remove_file(dev, &dev_attr_fp_glyph2.attr);
+	device_remove_file(dev, &dev_attr_fp_glyph3.attr);
+	device_remove_file(dev, &dev_attr_fp_glyph4.attr);
+	device_remove_file(dev, &dev_attr_fp_glyph5.attr);
+	device_remove_file(dev, &dev_attr_fp_glyph6.attr);
+	device_remove_file(dev, &dev_attr_fp_glyph7.attr);
+	device_remove_bin_file(dev, &bin_attr_fp_memory);
 	device_remove_file(dev, &dev_attr_fp_led_online);
 	device_remove_file(dev, &dev_attr_fp_led_power);
+	device_remove_file(dev, &dev_attr_fp_max_fps);
+	device_remove_file(dev, &dev_attr_fp_idle);
+	device_remove_file(dev, &dev_attr_fp_idle_timeout);
+	device_remove_file(dev, &dev_attr_fp_idle_blank);
+	device_remove_file(dev, &dev_attr_fp_button_debounce);
+	device_remove_file(dev, &dev_attr_fp_button_long);
+	device_remove_file(dev, &dev_attr_fp_button_repeat);
+	device_remove_file(dev, &dev_attr_fp_big_text);
+	device_remove_file(dev, &dev_attr_fp_glyph_bank);
+	device_remove_file(dev, &dev_attr_fp_viewport);
+	device_remove_file(dev, &dev_attr_fp_write_mode);
 	device_remove_file(dev, &dev_attr_fp_version);
-	device_destroy(piadagio_fp_class, MKDEV(piadagio_fp_major, 0));
 
-	class_unregister(piadagio_fp_class);
-	class_destroy(piadagio_fp_class);
+	// Stop new file operations, open files keep the data (not the client)
+	cdev_device_del(&data->cdev, &data->chrdev);
+	down_write(&data->remove_lock);
+
+	piadagio_fp_leds_unregister(data);
+	wait_event(data->bank_wait, (atomic_read(&data->bank_loads) == 0));	// Wait for any glyph bank loads
+	piadagio_fp_anim_stop(data);
+	cancel_work_sync(&data->menu_work);
+	piadagio_fp_menu_stop(data);
+	cancel_delayed_work_sync(&data->wq_task_lcd);	// Cancel any new tasks, and wait for running ones
+	cancel_delayed_work_sync(&data->wq_task_led);
+	cancel_delayed_work_sync(&data->wq_task_idle);
+	cancel_delayed_work_sync(&data->wq_task_buttons);
+	destroy_workqueue(data->wq);
+
+	pm_runtime_disable(dev);
+	pm_runtime_dont_use_autosuspend(dev);
+	if (!data->idle) {
+		pm_runtime_put_noidle(dev);
+	}
+	pm_runtime_set_suspended(dev);
+
+	data->client = NULL;
+	up_write(&data->remove_lock);
+
+	ida_simple_remove(&piadagio_fp_minors, MINOR(data->devt));
+	put_device(&data->chrdev);				// Frees data, once the last file is closed
+
+	return 0;
+}
 
-	unregister_chrdev(piadagio_fp_major, PIADAGIOFP_I2C_DEVNAME);
+// System suspend, stop all bus activity (the workqueue is frozen
+// after this, so nothing queued now runs until resume)
+static int __maybe_unused piadagio_fp_suspend(struct device *dev) {
+	struct piadagio_fp_data *data = dev_get_drvdata(dev);
 
-	piadagio_fp_wq_kill = 1;
-	cancel_delayed_work(&piadagio_fp_wq_task_lcd);	// Cancel any new tasks
-	cancel_delayed_work(&piadagio_fp_wq_task_led);	// Cancel any new tasks
-	flush_workqueue(piadagio_fp_wq);		// And wait until all "old ones" finished
-	destroy_workqueue(piadagio_fp_wq);
+	printd("%s\n", __FUNCTION__);
+
+	piadagio_fp_anim_stop(data);
+	cancel_delayed_work_sync(&data->wq_task_lcd);
+	cancel_delayed_work_sync(&data->wq_task_led);
+	cancel_delayed_work_sync(&data->wq_task_idle);
+	cancel_delayed_work_sync(&data->wq_task_buttons);
+	return 0;
+}
+
+// System resume, the panel may have lost power so resync everything
+static int __maybe_unused piadagio_fp_resume(struct device *dev) {
+	struct piadagio_fp_data *data = dev_get_drvdata(dev);
+
+	printd("%s\n", __FUNCTION__);
+
+	piadagio_fp_shadow_invalidate(data);
 
+	if (data->idle) {
+		piadagio_fp_idle_exit(data);				// Queues the LCD/LED tasks
+	} else {
+		data->lcd_last_updated = jiffies;
+		queue_delayed_work(data->wq, &data->wq_task_lcd, 0);
+		queue_delayed_work(data->wq, &data->wq_task_led, 0);
+	}
 	return 0;
 }
 
+static const struct dev_pm_ops piadagio_fp_pm_ops = {
+	SET_SYSTEM_SLEEP_PM_OPS(piadagio_fp_suspend, piadagio_fp_resume)
+};
+
 // Devices supported by this driver
 static const struct i2c_device_id piadagio_fp_id[] = {
 	{ "piadagio_fp", 0 },
@@ -982,6 +2842,8 @@ static const unsigned short scan_i2c_addrs[] = { PIADAGIOFP_I2C_ADDR, I2C_CLIENT
 static struct i2c_driver piadagio_fp_driver = {
 	.driver = {
 		.name	= PIADAGIOFP_I2C_DEVNAME,
+		.pm	= &piadagio_fp_pm_ops,
+		.probe_type = PROBE_PREFER_ASYNCHRONOUS,		// Don't hold up the boot
 	},
 	.id_table	= piadagio_fp_id,
 	.probe		= piadagio_fp_probe,
@@ -992,15 +2854,46 @@ static struct i2c_driver piadagio_fp_driver = {
 	.detect		= piadagio_fp_detect,
 	.address_list	= scan_i2c_addrs,
 };
-module_i2c_driver(piadagio_fp_driver);
 
-//static int __init piadagio_fp_init(void) {
-//	return i2c_add_driver(&piadagio_fp_driver);
-//module_init(piadagio_fp_init);
+// The class and device numbers are shared by all the panels
+static int __init piadagio_fp_init(void) {
+	int retval;
+
+	retval = alloc_chrdev_region(&piadagio_fp_devt, 0, PIADAGIOFP_MAX_DEVICES, PIADAGIOFP_I2C_DEVNAME);
+	if (retval < 0) {
+		printe("%s: Failed to allocate char device region!\n", __FUNCTION__);
+		return retval;
+	}
+
+	piadagio_fp_class = class_create(THIS_MODULE, PIADAGIOFP_I2C_DEVNAME);
+	if (IS_ERR(piadagio_fp_class)) {
+		retval = PTR_ERR(piadagio_fp_class);
+		printe("%s: Failed to create class!\n", __FUNCTION__);
+		goto unreg_region;
+	}
+
+	retval = i2c_add_driver(&piadagio_fp_driver);
+	if (retval < 0) {
+		goto unreg_class;
+	}
+
+	return 0;
+
+unreg_class:
+	class_destroy(piadagio_fp_class);
+unreg_region:
+	unregister_chrdev_region(piadagio_fp_devt, PIADAGIOFP_MAX_DEVICES);
+	return retval;
+}
+module_init(piadagio_fp_init);
 
-//static void __exit piadagio_fp_remove(void) {
-//	return i2c_del_driver(&piadagio_fp_driver);
-//module_exit(piadagio_fp_remove);
+static void __exit piadagio_fp_exit(void) {
+	i2c_del_driver(&piadagio_fp_driver);
+	class_destroy(piadagio_fp_class);
+	unregister_chrdev_region(piadagio_fp_devt, PIADAGIOFP_MAX_DEVICES);
+	ida_destroy(&piadagio_fp_minors);
+}
+module_exit(piadagio_fp_exit);
 
 MODULE_AUTHOR("Charles Burgoyne");
 MODULE_DESCRIPTION("Adagio front panel driver");
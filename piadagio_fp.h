@@ -12,29 +12,56 @@
 
 #define PIADAGIOFP_VERSION	"1.01"
 
-#define	PIADAGIOFP_I2C_ADDR	0x11
+#include "piadagio_fp_proto.h"
+#include "piadagio_fp_ioctl.h"
+
 #define PIADAGIOFP_I2C_DEVNAME "piadagio_fp"
 #define PIADAGIOFP_WQ_NAME 	"piadagio_fp_wq"
+#define PIADAGIOFP_MAX_DEVICES	8					// Maximum number of panels (minor numbers)
+#define PIADAGIOFP_REFRESH_DELAY	10				// Delay (jiffies) between refreshes of an unchanged screen
+#define PIADAGIOFP_EVENT_QUEUE_LEN	64				// Events queued for userspace (power of 2)
+#define PIADAGIOFP_KEY_QUEUE_LEN	8				// Key presses queued for the menu (power of 2)
+#define PIADAGIOFP_BUTTON_POLL		20				// Slowest button poll (ms) while a button is down
+#define PIADAGIOFP_BANK_NAME_LEN	32				// Maximum glyph bank name length (including the null)
+#define PIADAGIOFP_BANK_PATH		"piadagio_fp/"			// Glyph banks are loaded from /lib/firmware/piadagio_fp/<name>.bin
+#define PIADAGIOFP_RESET_ERRORS		5				// Consecutive bus errors treated as a possible panel reset
+#define PIADAGIOFP_RESYNC_INTERVAL	5				// Seconds between full resyncs while active (recovers from brownouts)
+#define PIADAGIOFP_SPLASH_LEN		((4 * LCD_LINE_LEN) + 4)	// Splash text, 4 lines separated by '|' (including the null)
+#define PIADAGIOFP_TEXT_CHUNK		64				// Text mode writes are parsed this much at a time
 
-#define	I2C_MSG_TYPE_CLEAR	0x1					// Clear screen
-#define	I2C_MSG_TYPE_CHAR	0x2					// Write characters to lcd
-#define	I2C_MSG_TYPE_GLYPH	0x4					// Update user defined fonts
-#define	I2C_MSG_TYPE_LED	0x8					// Control leds
+#define	PIADAGIOFP_MENU_KEY_UP		0				// Index of each key's command code
+#define	PIADAGIOFP_MENU_KEY_DOWN	1
+#define	PIADAGIOFP_MENU_KEY_SELECT	2
+#define	PIADAGIOFP_MENU_KEY_BACK	3
 
 #define	BUFFER_WRITE_CHAR	0x1					// Write to character buffer
 #define	BUFFER_WRITE_GLYPH	0x2					// Write to glyph buffer
+#define	BUFFER_WRITE_CANVAS	0x3					// Write to canvas buffer
 
-#define LCD_LINE_LEN		0x14
+#define SCREEN_BUFFER_LEN		(LCD_LINE_LEN * 4)		// Largest screen (rows x columns)
+#define	PIADAGIOFP_ROWS_MAX		4				// Most rows a panel can have
 struct piadagio_fp_char_buffer {
-	char line1[LCD_LINE_LEN];
-	char line2[LCD_LINE_LEN];
-	char line3[LCD_LINE_LEN];
-	char line4[LCD_LINE_LEN];
+	char chars[SCREEN_BUFFER_LEN];					// Row r starts at (r x columns)
+};
+#define	PIADAGIOFP_SCREEN_HALF_1	0x1					// DDRAM 0x00 (lines 1 & 3 on a 20x4 panel)
+#define	PIADAGIOFP_SCREEN_HALF_2	0x2					// DDRAM 0x40 (lines 2 & 4 on a 20x4 panel)
+#define	PIADAGIOFP_SCREEN_HALVES	(PIADAGIOFP_SCREEN_HALF_1 | PIADAGIOFP_SCREEN_HALF_2)
+
+// Panel geometry
+// Each row is sent in one of the screen halves, at a slot (a row's
+// width) into the half's payload.
+#define	PIADAGIOFP_GEOMETRY_CUSTOM	0
+#define	PIADAGIOFP_GEOMETRY_20X4	1
+#define	PIADAGIOFP_GEOMETRY_16X2	2
+#define	PIADAGIOFP_GEOMETRY_40X2	3
+struct piadagio_fp_geometry {
+	u8 kind;							// PIADAGIOFP_GEOMETRY_*, the common ones have fast paths
+	u8 rows;
+	u8 cols;
+	u8 half[PIADAGIOFP_ROWS_MAX];					// Screen half each row is sent in
+	u8 slot[PIADAGIOFP_ROWS_MAX];					// Position of each row in its half
+	u8 halves;							// Screen halves in use
 };
-#define SCREEN_BUFFER_LEN		(LCD_LINE_LEN * 4)
-#define	I2C_MSG_LEN_UPDATE_CGRAM	11				// Size of command to update 1 CGRAM glyph
-#define I2C_MSG_LEN_UPDATE_LED		3				// Size of command to update the LEDs
-#define I2C_MSG_LEN_UPDATE_LCD		((LCD_LINE_LEN * 2) + 3)	// Size of command to update half the lcd (This is the maximum msg size)
 #define I2C_BUFFER_LEN			(I2C_MSG_LEN_UPDATE_LCD + 1)	// Maximum i2c command size + 1 for the null character from sprintf
 
 struct piadagio_fp_glyph {						// Structure to hold data for a LCD UGRAM character
@@ -44,31 +71,241 @@ struct piadagio_fp_glyphs {						// Structure to hold complete LCD UGRAM data
 	struct piadagio_fp_glyph glyph[8];
 };
 #define	GLYPH_BUFFER_LEN	(8 * 8)
+#define	CANVAS_BUFFER_LEN	(LCD_LINE_LEN * PIADAGIOFP_CANVAS_LINES)
+
+// Text mode parser states
+#define	PIADAGIOFP_TEXT_NORMAL		0				// Characters are written at the cursor
+#define	PIADAGIOFP_TEXT_ESC		1				// ESC seen
+#define	PIADAGIOFP_TEXT_CSI		2				// ESC [ seen, collecting parameters
+#define	PIADAGIOFP_TEXT_LCD		3				// ESC [ L seen (LCD specific)
+#define	PIADAGIOFP_TEXT_GLYPH_INDEX	4				// ESC [ L G seen, waiting for the glyph index
+#define	PIADAGIOFP_TEXT_GLYPH_DATA	5				// Collecting the glyph's hex digits
+
+// Text mode results
+#define	PIADAGIOFP_TEXT_CHANGED		0x1				// The screen buffer changed
+#define	PIADAGIOFP_TEXT_COMMIT		0x2				// Commit the screen (form feed)
+
+// Text mode parser
+// Cursor and escape sequence state, kept between writes.
+struct piadagio_fp_text {
+	u8 state;							// PIADAGIOFP_TEXT_*
+	u8 row;								// Cursor (0 based)
+	u8 col;
+	u8 nparams;							// CSI parameters seen
+	unsigned int params[2];
+	u8 glyph_index;							// Glyph being defined
+	u8 glyph_nibbles;						// Hex digits collected
+	u8 glyph[8];
+};
+
+// Shadow of the panel state
+// What the panel has acknowledged, so only differences need to be sent.
+struct piadagio_fp_shadow {
+	struct piadagio_fp_char_buffer screen;				// Screen as last sent
+	struct piadagio_fp_glyphs cgram;				// Glyphs as last sent
+	unsigned char leds;						// LED status bits as last sent
+	u8 screen_valid;						// Screen halves known to be on the panel
+	u8 cgram_valid;							// Glyphs known to be on the panel (bit per glyph)
+	bool leds_valid;						// LEDs known to be set on the panel
+};
 
 #define	GLYPH_PRINT_HEAD	"---------------------\n"
 #define	GLYPH_PRINT_LINE	"| %u | %u | %u | %u | %u |	= %u\n"
-#define GLYPH_PRINT		GLYPH_PRINT_HEAD GLYPH_PRINT_LINE GLYPH_PRINT_HEAD GLYPH_PRINT_LINE GLYPH_PRINT_HEAD GLYPH_PRINT_LINE GLYPH_PRINT_HEAD GLYPH_PRINT_LINE GLYPH_PRINT_HEAD GLYPH_PRINT_LINE GLYPH_PRINT_HEAD GLYPH_PRINT_LINE GLYPH_PRINT_HEAD GLYPH_PRINT_LINE GLYPH_PRINT_HEAD GLYPH_PRINT_LINE GLYPH_PRINT_HEAD
 
+// Button states
+#define	PIADAGIOFP_BUTTON_IDLE		0				// No button down
+#define	PIADAGIOFP_BUTTON_DEBOUNCE	1				// Button seen, waiting for it to settle
+#define	PIADAGIOFP_BUTTON_PRESSED	2				// Button down
+#define	PIADAGIOFP_BUTTON_LONG		3				// Button held past the long press time, repeating
+
+// Button state machine
+// The FP only reports one button (command) at a time, so one state
+// machine tracks whichever button is down. Times are in ms.
+struct piadagio_fp_button {
+	unsigned int state;							// PIADAGIOFP_BUTTON_*
+	unsigned int code;							// Command of the button being tracked
+	s64 since;								// When the button was seen/pressed
+	s64 release;								// When the button was first seen released, -1 if held
+	s64 next_repeat;							// When the next repeat is due
+	unsigned int repeats;							// Repeats since the long press
+	unsigned int debounce;							// Time a change must be stable for
+	unsigned int long_press;						// Hold time for a long press, 0 disables
+	unsigned int repeat;							// Repeat interval after a long press, 0 disables
+};
+
+// Statistics counters
+// Each counter is an atomic64, as they are updated from the workqueue
+// and read/reset from sysfs without any common lock.
+enum piadagio_fp_stat {
+	PIADAGIOFP_STAT_UPDATE_LCD = 0,						// Screen half updates sent
+	PIADAGIOFP_STAT_UPDATE_GLYPH,						// Glyph updates sent
+	PIADAGIOFP_STAT_UPDATE_LED,						// LED updates sent
+	PIADAGIOFP_STAT_BYTES_SENT,						// Total bytes written to the FP
+	PIADAGIOFP_STAT_FRAMES_SKIPPED,						// Writes held back until a fsync (counted once per hold)
+	PIADAGIOFP_STAT_FRAMES_SUBMITTED,					// Frames committed
+	PIADAGIOFP_STAT_FRAMES_DISPLAYED,					// Committed frames that reached the panel
+	PIADAGIOFP_STAT_FRAMES_SUPERSEDED,					// Committed frames merged into a later one
+	PIADAGIOFP_STAT_RETRIES_LCD,						// FP busy, screen update deferred
+	PIADAGIOFP_STAT_RETRIES_GLYPH,						// FP busy, glyph update deferred
+	PIADAGIOFP_STAT_RETRIES_LED,						// FP busy, LED update deferred
+	PIADAGIOFP_STAT_ERRORS_STATUS,						// Failed status reads
+	PIADAGIOFP_STAT_ERRORS_LCD,						// Failed screen updates
+	PIADAGIOFP_STAT_ERRORS_GLYPH,						// Failed glyph updates
+	PIADAGIOFP_STAT_ERRORS_LED,						// Failed LED updates
+	PIADAGIOFP_STAT_BUS_NACK,						// Bus error: no acknowledge
+	PIADAGIOFP_STAT_BUS_TIMEOUT,						// Bus error: timeout
+	PIADAGIOFP_STAT_BUS_ARBITRATION,					// Bus error: arbitration lost
+	PIADAGIOFP_STAT_BUS_SHORT,						// Bus error: short transfer
+	PIADAGIOFP_STAT_BUS_OTHER,						// Bus error: anything else
+	PIADAGIOFP_STAT_EVENTS_DROPPED,						// Events lost, as the queue was full
+	PIADAGIOFP_STAT_UPDATES_SUPPRESSED,					// Updates not sent, as the panel already matched
+	PIADAGIOFP_STAT_RESYNCS,						// Shadow discarded after a possible panel reset
+	PIADAGIOFP_STAT_MAX
+};
+
+// Per panel state
 struct piadagio_fp_data {
+	struct i2c_client *client;
 	struct mutex update_lock;
 	unsigned long lcd_last_updated;		// In jiffies
 	unsigned long command_last_read;	// In jiffies
 	int kind;
+
+	// Character device
+	struct cdev cdev;
+	struct device chrdev;							// Holds the last reference to this struct
+	dev_t devt;
+	struct mutex open_lock;							// Only one process at a time can access /dev
+	struct rw_semaphore remove_lock;					// Held (read) by file operations, (write) by remove
+
+	// Work queue variables
+	struct workqueue_struct *wq;
+	struct delayed_work wq_task_lcd;
+	struct delayed_work wq_task_led;
+	struct delayed_work wq_task_idle;					// Slow (deferrable) button poll while idle
+	struct delayed_work wq_task_buttons;					// Fast button poll while a button is down
+	bool wq_kill;								// Set on removal (READ_ONCE/WRITE_ONCE), stops requeueing
+
+	// Idle
+	struct mutex idle_lock;
+	bool idle;								// No recent activity, periodic updates stopped
+	bool idle_blank;							// Blank the display when idle
+	unsigned int idle_timeout;						// Inactivity (ms) before going idle, 0 disables
+
+	// Actual data storage
+	struct piadagio_fp_geometry geometry;					// Panel size, and how the rows are sent
+	struct piadagio_fp_char_buffer buffer_lcd_screen;			// Buffer for the LCD screen
+	struct piadagio_fp_glyphs buffer_lcd_ugram;				// Buffer for the LCD UGRAM
+	unsigned int buffer_index;						// Write position in the screen buffer
+	unsigned char buffer_i2c_rw[I2C_BUFFER_LEN];				// Structure to r/w i2c data
+	unsigned int glyph_index;						// Write position in the glyph buffer
+	char buffer_canvas[CANVAS_BUFFER_LEN];					// Virtual canvas, the viewport is shown on the screen
+	unsigned int canvas_index;						// Write position in the canvas buffer
+	unsigned int canvas_viewport;						// First canvas line shown on the screen
+	bool canvas_active;							// Screen shows the canvas (until the screen is written directly)
+	unsigned char write_to_buffer;						// Which buffer to write to
+	unsigned int buffer_command;						// Command read from the FP
+	atomic64_t stats[PIADAGIOFP_STAT_MAX];					// Statistics counters
+	struct piadagio_fp_shadow shadow;					// What the panel has acknowledged
+	unsigned int error_burst;						// Consecutive bus errors
+	bool resync_pending;							// Resync requested (READ_ONCE/WRITE_ONCE), handled by the LCD task
+	unsigned long shadow_resync_last;						// When the shadow was last discarded (jiffies)
+	unsigned short i2c_update_do;						// Controls whether an update actually happens (they're still scheduled)
+	unsigned short i2c_update_do_screen;					// Controls whether a screen update actually happens
+	unsigned short led_online;						// Online LED status
+	unsigned short led_power;						// Power LED status
+	struct led_classdev led_cdev_online;					// LED class device for the online LED
+	struct led_classdev led_cdev_power;					// LED class device for the power LED
+
+	// Glyph banks
+	struct mutex bank_lock;
+	char bank_name[PIADAGIOFP_BANK_NAME_LEN];				// Last glyph bank loaded
+	u32 bank_seq;								// Incremented for each glyph bank requested
+	atomic_t bank_loads;							// Glyph bank requests outstanding
+	wait_queue_head_t bank_wait;						// Woken when a glyph bank request completes
+	bool glyph_updated[8];							// Stores whether a LCD UGRAM glyph has been updated
+	bool i2c_update_screen_other_half;					// Used to store which half of the screen to update next
+
+	// Frame sequencing
+	spinlock_t frame_lock;							// Protects the commit sequence number
+	u8 frame_halves;							// Screen halves still to send for the frame in flight
+	wait_queue_head_t frame_wait;						// Woken when a frame has been displayed
+	u32 frame_commit_seq;							// Sequence number of the last commit
+	u32 frame_sending_seq;							// Sequence number of the frame being sent
+	u32 frame_displayed_seq;						// Sequence number of the last frame displayed
+	unsigned long frame_last_start;						// When the last frame was started (jiffies)
+	unsigned long frame_interval;						// Minimum time between new frames (jiffies)
+	unsigned int frame_max_fps;						// Maximum frame rate, 0 is uncapped
+
+	// Animation
+	struct mutex anim_lock;
+	struct hrtimer anim_timer;						// Expires when the next keyframe is due
+	struct work_struct anim_work;						// Applies the next keyframe
+	struct piadagio_fp_keyframe *anim_frames;				// Keyframes being played, NULL when stopped
+	unsigned int anim_count;						// Number of keyframes
+	unsigned int anim_index;						// Next keyframe to apply
+	unsigned int anim_loops;						// Loops remaining, 0 repeats forever
+	ktime_t anim_next;							// When the next keyframe is due
+
+	// Events
+	DECLARE_KFIFO(events, struct piadagio_fp_event, PIADAGIOFP_EVENT_QUEUE_LEN);
+	wait_queue_head_t event_wait;						// Woken when an event has been queued
+	struct mutex event_read_lock;						// Serialises readers of the event queue
+	unsigned int read_mode;							// What read() returns (PIADAGIOFP_READ_*)
+
+	// Text mode
+	unsigned int write_mode;						// What write() does (PIADAGIOFP_WRITE_*)
+	struct piadagio_fp_text text;						// Cursor and parser state
+
+	// Menu
+	struct mutex menu_lock;
+	struct work_struct menu_work;						// Handles key presses for the menu
+	DECLARE_KFIFO(menu_keys, u8, PIADAGIOFP_KEY_QUEUE_LEN);			// Key presses waiting to be handled
+	struct piadagio_fp_menu_item *menu_items;				// Menu tree, NULL when there's no menu
+	unsigned int menu_count;						// Number of items
+	u8 menu_key[4];								// Command codes for up/down/select/back
+	u16 menu_parent;							// Parent of the level being shown
+	unsigned int menu_pos;							// Highlighted item (position within the level)
+	unsigned int menu_top;							// First item shown (position within the level)
+
+	// Buttons
+	struct piadagio_fp_button button;
 };
 
+// Sequence number comparison (handles wrap around)
+#define	piadagio_fp_seq_after_eq(a, b)	((s32) ((a) - (b)) >= 0)
+
 // General routines
 /////////////////////////////////////////////////////////////////////
-void piadagio_fp_buffer_lcd_clear(void);
-void piadagio_fp_buffer_ugram_init(void);
-int piadagio_fp_i2c_get_status(void);
-int piadagio_fp_i2c_update_screen(void);
-int piadagio_fp_i2c_update_glyph(unsigned char glyph_index);
-int piadagio_fp_i2c_update_leds(void);
+void piadagio_fp_buffer_lcd_clear(struct piadagio_fp_data *data);
+void piadagio_fp_buffer_ugram_init(struct piadagio_fp_data *data);
+int piadagio_fp_i2c_get_status(struct piadagio_fp_data *data);
+int piadagio_fp_i2c_update_screen(struct piadagio_fp_data *data);
+int piadagio_fp_i2c_update_glyph(struct piadagio_fp_data *data, unsigned char glyph_index);
+int piadagio_fp_i2c_update_leds(struct piadagio_fp_data *data);
+int piadagio_fp_i2c_clear(struct piadagio_fp_data *data);
+
+// The unit tests (piadagio_fp_test.c) only use the types, and the
+// helpers in piadagio_fp_lib.h
+#ifndef PIADAGIOFP_KUNIT_TEST
+// Frame routines
+/////////////////////////////////////////////////////////////////////
+static void piadagio_fp_frame_resync(struct piadagio_fp_data *data);
+static void piadagio_fp_shadow_invalidate(struct piadagio_fp_data *data);
+static void piadagio_fp_anim_stop(struct piadagio_fp_data *data);
+
+// Button routines
+/////////////////////////////////////////////////////////////////////
+static void piadagio_fp_buttons_update(struct piadagio_fp_data *data);
 
 // Workqueue routines
 /////////////////////////////////////////////////////////////////////
 static void piadagio_fp_task_lcd_update(struct work_struct *work);
 static void piadagio_fp_task_led_update(struct work_struct *work);
+static void piadagio_fp_task_idle_poll(struct work_struct *work);
+static void piadagio_fp_task_anim(struct work_struct *work);
+static void piadagio_fp_task_menu(struct work_struct *work);
+static void piadagio_fp_task_buttons(struct work_struct *work);
 
 // Character device
 /////////////////////////////////////////////////////////////////////
@@ -78,6 +315,8 @@ static ssize_t piadagio_fp_read(struct file *filp, char *buffer, size_t length,
 static ssize_t piadagio_fp_write(struct file * fp, const char __user * buf, size_t count, loff_t * offset);
 static loff_t piadagio_fp_llseek(struct file *file, loff_t offset, int origin);
 static int piadagio_fp_fsync(struct file *file, loff_t start, loff_t end, int datasync);
+static long piadagio_fp_ioctl(struct file *file, unsigned int cmd, unsigned long arg);
+static __poll_t piadagio_fp_poll(struct file *file, poll_table *wait);
 
 // I2C driver
 /////////////////////////////////////////////////////////////////////
@@ -87,6 +326,6 @@ static int piadagio_fp_remove(struct i2c_client * client);
 
 // Module
 /////////////////////////////////////////////////////////////////////
-// Not used
-//static int __init piadagio_fp_init(void);
-//static void __exit piadagio_fp_remove(void);
+static int __init piadagio_fp_init(void);
+static void __exit piadagio_fp_exit(void);
+#endif
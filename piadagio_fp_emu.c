@@ -0,0 +1,449 @@
+////////////////////////////////////////////////////////////////////
+//
+// piadagio_fp_emu
+// Emulates the Adagio front panel (Adagio-PIC-FP firmware) as an
+// i2c slave backend, so the piadagio_fp driver can be exercised and
+// benchmarked without the real hardware.
+//
+// Instantiate on a bus master that supports slave mode, e.g.:
+//	echo piadagio_fp_emu 0x1011 > /sys/bus/i2c/devices/i2c-N/new_device
+//
+// The emulated screen, glyphs, and LEDs are exposed through sysfs,
+// along with counters that can be used to work out frame rate and bus
+// efficiency. The screen geometry is set with module parameters (read
+// when the emulator is instantiated), to match the driver's.
+//
+////////////////////////////////////////////////////////////////////
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/i2c.h>
+#include <linux/spinlock.h>
+#include <linux/ktime.h>
+#include <linux/sysfs.h>
+#include <linux/device.h>
+#include "piadagio_fp_proto.h"
+
+#define PIADAGIOFP_EMU_DEVNAME	"piadagio_fp_emu"
+#define PIADAGIOFP_EMU_RX_LEN	(I2C_MSG_LEN_UPDATE_LCD + 1)		// Largest message + 1 for overrun detection
+#define PIADAGIOFP_EMU_ROWS_MAX	4					// Most rows a panel can have
+#define PIADAGIOFP_EMU_SCREEN_LEN	(LCD_LINE_LEN * 4)		// Largest screen (rows x columns)
+
+static unsigned int fp_emu_busy_us = 1000;
+module_param(fp_emu_busy_us, uint, 0660);
+MODULE_PARM_DESC(fp_emu_busy_us, "Time (us) the emulated FP reports busy after processing a command.\n");
+
+static unsigned int fp_emu_rows = 4;
+module_param(fp_emu_rows, uint, 0660);
+MODULE_PARM_DESC(fp_emu_rows, "Rows on the emulated screen (up to 4).\n");
+
+static unsigned int fp_emu_columns = LCD_LINE_LEN;
+module_param(fp_emu_columns, uint, 0660);
+MODULE_PARM_DESC(fp_emu_columns, "Columns on the emulated screen (no more than 80 characters).\n");
+
+static unsigned int fp_emu_line_interleave[PIADAGIOFP_EMU_ROWS_MAX];
+static int fp_emu_line_interleave_count;
+module_param_array(fp_emu_line_interleave, uint, &fp_emu_line_interleave_count, 0660);
+MODULE_PARM_DESC(fp_emu_line_interleave, "Rows (0 based) in the order they're sent, the first half in the first screen half (default alternates).\n");
+
+struct piadagio_fp_emu_data {
+	spinlock_t lock;							// Taken in the slave callback (hard IRQ), so irqsave elsewhere
+	char screen[PIADAGIOFP_EMU_SCREEN_LEN];			// Screen as it would appear on the glass, row r starts at (r x columns)
+	unsigned int rows;						// Screen geometry
+	unsigned int cols;
+	u8 half[PIADAGIOFP_EMU_ROWS_MAX];				// Screen half (0/1) each row is sent in
+	u8 slot[PIADAGIOFP_EMU_ROWS_MAX];				// Position of each row in its half
+	u8 halves;							// Screen halves in use (bitmask)
+	unsigned char cgram[8][8];					// CGRAM glyphs
+	unsigned char leds;						// LED status bits
+	unsigned char command;						// Emulated button command
+	unsigned char rx_buffer[PIADAGIOFP_EMU_RX_LEN];			// Message being received
+	unsigned int rx_index;
+	unsigned int tx_index;
+	ktime_t busy_until;						// FP busy until this time
+	ktime_t first_msg;						// Time of the first message since reset
+	ktime_t last_msg;						// Time of the last message
+	unsigned long msg_clear;					// Message counters
+	unsigned long msg_char;
+	unsigned long msg_glyph;
+	unsigned long msg_led;
+	unsigned long msg_malformed;
+	unsigned long msg_while_busy;					// Commands sent while the FP reported busy
+	unsigned long status_reads;
+	unsigned long bytes_rx;
+	unsigned long frames;						// Complete screens (all halves in use) received
+	u8 halves_received;
+};
+
+////////////////////////////////////////////////////////////////////
+// Protocol emulation
+////////////////////////////////////////////////////////////////////
+// Process a complete message from the driver
+// Called with the lock held.
+static void piadagio_fp_emu_process(struct piadagio_fp_emu_data *data) {
+	unsigned char *msg = data->rx_buffer;
+	unsigned int len = data->rx_index;
+	unsigned int i, half;
+	ktime_t now;
+
+	if (len == 0) {								// Status read, nothing to do
+		return;
+	}
+
+	now = ktime_get();
+	data->bytes_rx += len;
+	if ((len < 2) || (msg[0] != (len - 1))) {				// Length byte doesn't include itself
+		data->msg_malformed++;
+		return;
+	}
+	if (ktime_before(now, data->busy_until)) {
+		data->msg_while_busy++;
+	}
+	if ((data->msg_clear + data->msg_char + data->msg_glyph + data->msg_led) == 0) {
+		data->first_msg = now;
+	}
+	data->last_msg = now;
+
+	switch (msg[1]) {
+	case I2C_MSG_TYPE_CLEAR:
+		memset(data->screen, ' ', sizeof(data->screen));
+		data->msg_clear++;
+		break;
+	case I2C_MSG_TYPE_CHAR:
+		if ((len != I2C_MSG_LEN_UPDATE_LCD) || (msg[2] > 1)) {
+			data->msg_malformed++;
+			return;
+		}
+		// Each row is at its slot in the half it's sent in
+		half = msg[2];
+		for (i = 0; i < data->rows; i++) {
+			if (data->half[i] == half) {
+				memcpy(&data->screen[i * data->cols], &msg[3 + (data->slot[i] * data->cols)], data->cols);
+			}
+		}
+		data->halves_received |= (1 << half);
+		if ((data->halves_received & data->halves) == data->halves) {
+			data->halves_received = 0;
+			data->frames++;
+		}
+		data->msg_char++;
+		break;
+	case I2C_MSG_TYPE_GLYPH:
+		if ((len != I2C_MSG_LEN_UPDATE_CGRAM) || (msg[2] > 7)) {
+			data->msg_malformed++;
+			return;
+		}
+		for (i = 0; i < 8; i++) {
+			data->cgram[msg[2]][i] = msg[3 + i];
+		}
+		data->msg_glyph++;
+		break;
+	case I2C_MSG_TYPE_LED:
+		if (len != I2C_MSG_LEN_UPDATE_LED) {
+			data->msg_malformed++;
+			return;
+		}
+		data->leds = msg[2];
+		data->msg_led++;
+		break;
+	default:
+		data->msg_malformed++;
+		return;
+	}
+
+	data->busy_until = ktime_add_us(now, fp_emu_busy_us);
+}
+
+// i2c slave event callback (runs in the bus driver's interrupt context)
+static int piadagio_fp_emu_slave_cb(struct i2c_client *client, enum i2c_slave_event event, u8 *val) {
+	struct piadagio_fp_emu_data *data = i2c_get_clientdata(client);
+
+	spin_lock(&data->lock);
+	switch (event) {
+	case I2C_SLAVE_WRITE_REQUESTED:
+		data->rx_index = 0;
+		break;
+	case I2C_SLAVE_WRITE_RECEIVED:
+		if (data->rx_index < PIADAGIOFP_EMU_RX_LEN) {
+			data->rx_buffer[data->rx_index++] = *val;
+		}
+		break;
+	case I2C_SLAVE_READ_REQUESTED:
+		// First byte of a read is the status
+		data->tx_index = 1;
+		data->status_reads++;
+		if (ktime_before(ktime_get(), data->busy_until)) {
+			*val = I2C_FP_STATUS_BUSY;
+		} else {
+			*val = I2C_FP_STATUS_READY;
+		}
+		break;
+	case I2C_SLAVE_READ_PROCESSED:
+		// Second byte is the command, anything after that is padding
+		*val = (data->tx_index++ == 1) ? data->command : 0;
+		break;
+	case I2C_SLAVE_STOP:
+		piadagio_fp_emu_process(data);
+		data->rx_index = 0;
+		break;
+	default:
+		break;
+	}
+	spin_unlock(&data->lock);
+
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////
+// SysFS
+////////////////////////////////////////////////////////////////////
+// SysFS object to display the emulated screen
+static ssize_t piadagio_fp_emu_get_screen(struct device *dev, struct device_attribute *dev_attr, char * buf) {
+	struct piadagio_fp_emu_data *data = dev_get_drvdata(dev);
+	char tmp_screen[PIADAGIOFP_EMU_SCREEN_LEN];
+	unsigned int i;
+	ssize_t tmp_index = 0;
+	unsigned long flags;
+
+	spin_lock_irqsave(&data->lock, flags);
+	memcpy(tmp_screen, data->screen, sizeof(tmp_screen));
+	spin_unlock_irqrestore(&data->lock, flags);
+
+	for (i = 0; i < data->rows; i++) {
+		tmp_index += scnprintf(buf + tmp_index, PAGE_SIZE - tmp_index, "%.*s\n", data->cols, &tmp_screen[i * data->cols]);
+	}
+	return tmp_index;
+}
+
+// SysFS object to display the emulated CGRAM, one glyph per line
+static ssize_t piadagio_fp_emu_get_cgram(struct device *dev, struct device_attribute *dev_attr, char * buf) {
+	struct piadagio_fp_emu_data *data = dev_get_drvdata(dev);
+	unsigned char tmp_cgram[8][8];
+	int i, tmp_index = 0;
+	unsigned long flags;
+
+	spin_lock_irqsave(&data->lock, flags);
+	memcpy(tmp_cgram, data->cgram, sizeof(tmp_cgram));
+	spin_unlock_irqrestore(&data->lock, flags);
+
+	for (i = 0; i < 8; i++) {
+		tmp_index += sprintf((buf + tmp_index), "%8phN\n", tmp_cgram[i]);
+	}
+	return tmp_index;
+}
+
+// SysFS object to display the emulated LED status
+static ssize_t piadagio_fp_emu_get_leds(struct device *dev, struct device_attribute *dev_attr, char * buf) {
+	struct piadagio_fp_emu_data *data = dev_get_drvdata(dev);
+	unsigned long flags;
+	unsigned char tmp_leds;
+
+	spin_lock_irqsave(&data->lock, flags);
+	tmp_leds = data->leds;
+	spin_unlock_irqrestore(&data->lock, flags);
+
+	return sprintf(buf, "power=%u\nonline=%u\n", (tmp_leds & 1) > 0, (tmp_leds & 2) > 0);
+}
+
+// SysFS object to display the emulated button command
+static ssize_t piadagio_fp_emu_get_command(struct device *dev, struct device_attribute *dev_attr, char * buf) {
+	struct piadagio_fp_emu_data *data = dev_get_drvdata(dev);
+	unsigned long flags;
+	unsigned char tmp_command;
+
+	spin_lock_irqsave(&data->lock, flags);
+	tmp_command = data->command;
+	spin_unlock_irqrestore(&data->lock, flags);
+
+	return sprintf(buf, "%u\n", tmp_command);
+}
+
+// SysFS object to set the emulated button command (simulate a button press)
+static ssize_t piadagio_fp_emu_set_command(struct device *dev, struct device_attribute * devattr, const char * buf, size_t count) {
+	struct piadagio_fp_emu_data *data = dev_get_drvdata(dev);
+	unsigned long flags;
+	u8 value;
+	int err;
+
+	err = kstrtou8(buf, 0, &value);
+	if (err < 0) {
+		return err;
+	}
+	spin_lock_irqsave(&data->lock, flags);
+	data->command = value;
+	spin_unlock_irqrestore(&data->lock, flags);
+	return count;
+}
+
+// SysFS object to display the emulator counters, one key=value per line
+static ssize_t piadagio_fp_emu_get_stats(struct device *dev, struct device_attribute *dev_attr, char * buf) {
+	struct piadagio_fp_emu_data *data = dev_get_drvdata(dev);
+	ssize_t tmp_index;
+	unsigned long flags;
+
+	spin_lock_irqsave(&data->lock, flags);
+	tmp_index = sprintf(buf, "msg_clear=%lu\nmsg_char=%lu\nmsg_glyph=%lu\nmsg_led=%lu\nmsg_malformed=%lu\nmsg_while_busy=%lu\n"
+				"status_reads=%lu\nbytes_rx=%lu\nframes=%lu\nactive_us=%lld\n",
+				data->msg_clear, data->msg_char, data->msg_glyph, data->msg_led,
+				data->msg_malformed, data->msg_while_busy,
+				data->status_reads, data->bytes_rx, data->frames,
+				ktime_us_delta(data->last_msg, data->first_msg));
+	spin_unlock_irqrestore(&data->lock, flags);
+	return tmp_index;
+}
+
+// SysFS object to reset the emulator counters (write 1)
+static ssize_t piadagio_fp_emu_set_stats_reset(struct device *dev, struct device_attribute * devattr, const char * buf, size_t count) {
+	struct piadagio_fp_emu_data *data = dev_get_drvdata(dev);
+	unsigned long flags;
+	int value, err;
+
+	err = kstrtoint(buf, 10, &value);
+	if (err < 0) {
+		return err;
+	} else if (value > 0) {
+		spin_lock_irqsave(&data->lock, flags);
+		data->msg_clear = 0;
+		data->msg_char = 0;
+		data->msg_glyph = 0;
+		data->msg_led = 0;
+		data->msg_malformed = 0;
+		data->msg_while_busy = 0;
+		data->status_reads = 0;
+		data->bytes_rx = 0;
+		data->frames = 0;
+		data->halves_received = 0;
+		data->first_msg = 0;
+		data->last_msg = 0;
+		spin_unlock_irqrestore(&data->lock, flags);
+	}
+	return count;
+}
+
+static DEVICE_ATTR(emu_screen, S_IRUGO, piadagio_fp_emu_get_screen, NULL);
+static DEVICE_ATTR(emu_cgram, S_IRUGO, piadagio_fp_emu_get_cgram, NULL);
+static DEVICE_ATTR(emu_leds, S_IRUGO, piadagio_fp_emu_get_leds, NULL);
+static DEVICE_ATTR(emu_command, 0644, piadagio_fp_emu_get_command, piadagio_fp_emu_set_command);
+static DEVICE_ATTR(emu_stats, S_IRUGO, piadagio_fp_emu_get_stats, NULL);
+static DEVICE_ATTR(emu_stats_reset, 0200, NULL, piadagio_fp_emu_set_stats_reset);
+
+static struct attribute *piadagio_fp_emu_attrs[] = {
+	&dev_attr_emu_screen.attr,
+	&dev_attr_emu_cgram.attr,
+	&dev_attr_emu_leds.attr,
+	&dev_attr_emu_command.attr,
+	&dev_attr_emu_stats.attr,
+	&dev_attr_emu_stats_reset.attr,
+	NULL
+};
+
+static const struct attribute_group piadagio_fp_emu_group = {
+	.attrs = piadagio_fp_emu_attrs,
+};
+
+////////////////////////////////////////////////////////////////////
+// Geometry
+////////////////////////////////////////////////////////////////////
+// Set the screen geometry from the module parameters, laid out the
+// same as the driver: by default the rows alternate between the halves
+// (1 & 3, then 2 & 4 on a 20x4 panel).
+// Returns 0, or -EINVAL if the geometry can't be sent.
+static int piadagio_fp_emu_geometry_init(struct piadagio_fp_emu_data *data) {
+	unsigned int tmp_slots = DIV_ROUND_UP(fp_emu_rows, 2);			// Rows per half
+	unsigned int i, tmp_row;
+	u8 tmp_seen = 0;
+
+	if ((fp_emu_rows == 0) || (fp_emu_rows > PIADAGIOFP_EMU_ROWS_MAX) || (fp_emu_columns == 0) ||
+			((fp_emu_rows * fp_emu_columns) > PIADAGIOFP_EMU_SCREEN_LEN) || ((tmp_slots * fp_emu_columns) > (2 * LCD_LINE_LEN))) {
+		return -EINVAL;
+	}
+	if ((fp_emu_line_interleave_count > 0) && (fp_emu_line_interleave_count != fp_emu_rows)) {
+		return -EINVAL;
+	}
+
+	data->rows = fp_emu_rows;
+	data->cols = fp_emu_columns;
+	data->halves = 0;
+	for (i = 0; i < data->rows; i++) {
+		if (fp_emu_line_interleave_count > 0) {
+			tmp_row = fp_emu_line_interleave[i];
+			if ((tmp_row >= data->rows) || (tmp_seen & (1 << tmp_row))) {
+				return -EINVAL;
+			}
+			tmp_seen |= (1 << tmp_row);
+		} else {
+			tmp_row = ((i % tmp_slots) * 2) + (i / tmp_slots);
+		}
+		data->half[tmp_row] = (i < tmp_slots) ? 0 : 1;
+		data->slot[tmp_row] = i % tmp_slots;
+		data->halves |= (1 << data->half[tmp_row]);
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////
+// I2C methods
+////////////////////////////////////////////////////////////////////
+// Device instantiation
+static int piadagio_fp_emu_probe(struct i2c_client *client, const struct i2c_device_id *id) {
+	struct piadagio_fp_emu_data *data;
+	int retval;
+
+	data = devm_kzalloc(&client->dev, sizeof(struct piadagio_fp_emu_data), GFP_KERNEL);
+	if (!data) {
+		return -ENOMEM;
+	}
+
+	retval = piadagio_fp_emu_geometry_init(data);
+	if (retval) {
+		dev_err(&client->dev, "Invalid screen geometry\n");
+		return retval;
+	}
+
+	spin_lock_init(&data->lock);
+	memset(data->screen, ' ', sizeof(data->screen));
+	data->leds = 1;								// Power LED on at reset
+	i2c_set_clientdata(client, data);
+
+	retval = sysfs_create_group(&client->dev.kobj, &piadagio_fp_emu_group);
+	if (retval) {
+		return retval;
+	}
+
+	retval = i2c_slave_register(client, piadagio_fp_emu_slave_cb);
+	if (retval) {
+		sysfs_remove_group(&client->dev.kobj, &piadagio_fp_emu_group);
+		return retval;
+	}
+
+	dev_info(&client->dev, "PiAdagio front panel emulator at 0x%02x (%ux%u)\n", client->addr, data->cols, data->rows);
+	return 0;
+}
+
+// Device removal
+static int piadagio_fp_emu_remove(struct i2c_client * client) {
+	i2c_slave_unregister(client);
+	sysfs_remove_group(&client->dev.kobj, &piadagio_fp_emu_group);
+	return 0;
+}
+
+static const struct i2c_device_id piadagio_fp_emu_id[] = {
+	{ PIADAGIOFP_EMU_DEVNAME, 0 },
+	{}
+};
+MODULE_DEVICE_TABLE(i2c, piadagio_fp_emu_id);
+
+static struct i2c_driver piadagio_fp_emu_driver = {
+	.driver = {
+		.name	= PIADAGIOFP_EMU_DEVNAME,
+	},
+	.id_table	= piadagio_fp_emu_id,
+	.probe		= piadagio_fp_emu_probe,
+	.remove		= piadagio_fp_emu_remove,
+};
+module_i2c_driver(piadagio_fp_emu_driver);
+
+MODULE_AUTHOR("Charles Burgoyne");
+MODULE_DESCRIPTION("Adagio front panel i2c slave emulator");
+MODULE_LICENSE("GPL");
@@ -0,0 +1,129 @@
+// piadagio_fp userspace interface
+// ioctls supported by the /dev/piadagio_fp character device.
+#ifndef _PIADAGIO_FP_IOCTL_H
+#define _PIADAGIO_FP_IOCTL_H
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+#define	PIADAGIOFP_IOC_MAGIC		0xAD
+
+// Frame commit
+// Commits the screen buffer (as fsync), returning the frame's sequence
+// number. With PIADAGIOFP_COMMIT_WAIT, blocks until both halves of the
+// frame have been acknowledged by the panel.
+#define	PIADAGIOFP_COMMIT_WAIT		0x1
+struct piadagio_fp_commit {
+	__u32 flags;							// In: PIADAGIOFP_COMMIT_*
+	__u32 seq;							// Out: Sequence number of the committed frame
+};
+#define	PIADAGIOFP_IOC_COMMIT		_IOWR(PIADAGIOFP_IOC_MAGIC, 0x01, struct piadagio_fp_commit)
+
+// Wait for a previously committed frame (by sequence number) to be displayed
+#define	PIADAGIOFP_IOC_WAIT_FRAME	_IOW(PIADAGIOFP_IOC_MAGIC, 0x02, __u32)
+
+// Returns the sequence number of the last frame displayed
+#define	PIADAGIOFP_IOC_GET_DISPLAYED	_IOR(PIADAGIOFP_IOC_MAGIC, 0x03, __u32)
+
+// Animation
+// Uploads a sequence of keyframes which are played back by the driver.
+// Each keyframe can replace the screen and/or any of the glyphs, and is
+// displayed for duration_ms before the next is applied. Only the screen
+// halves and glyphs that differ from what is already displayed are
+// sent. The sequence is repeated loops times (0 repeats until stopped).
+// Playback stops on any normal commit (write/fsync/PIADAGIOFP_IOC_COMMIT).
+#define	PIADAGIOFP_ANIM_MAX_FRAMES	64
+#define	PIADAGIOFP_KEYFRAME_SCREEN	0x1				// screen is valid
+#define	PIADAGIOFP_KEYFRAME_GLYPHS	0x2				// glyphs selected by glyph_mask are valid
+struct piadagio_fp_keyframe {
+	__u16 duration_ms;						// How long to display this keyframe
+	__u8 flags;							// PIADAGIOFP_KEYFRAME_*
+	__u8 glyph_mask;						// Bit n set updates glyph n
+	__u8 screen[80];						// Lines 1 to 4, as the device memory map
+	__u8 glyphs[8][8];						// Glyph pixel lines, as the device memory map
+};
+struct piadagio_fp_animation {
+	__u32 count;							// Number of keyframes
+	__u32 loops;							// Times to play the sequence, 0 is forever
+	__u64 keyframes;						// Pointer to the keyframes (struct piadagio_fp_keyframe)
+};
+#define	PIADAGIOFP_IOC_ANIM_START	_IOW(PIADAGIOFP_IOC_MAGIC, 0x04, struct piadagio_fp_animation)
+#define	PIADAGIOFP_IOC_ANIM_STOP	_IO(PIADAGIOFP_IOC_MAGIC, 0x05)
+
+// Virtual canvas
+// The canvas (PIADAGIOFP_CANVAS_LINES lines, on a 20 column panel, lines
+// are the panel's width) is written at offset 256 of the device. Setting
+// the viewport displays a screen's worth of canvas lines starting at the
+// given line, only the screen halves that change are sent.
+#define	PIADAGIOFP_CANVAS_LINES		256
+#define	PIADAGIOFP_IOC_SET_VIEWPORT	_IOW(PIADAGIOFP_IOC_MAGIC, 0x06, __u32)
+
+// Events
+// By default read() returns the raw button command byte, in event mode
+// it returns whole struct piadagio_fp_event records (blocking, unless
+// O_NONBLOCK), and the device polls readable when an event is queued.
+#define	PIADAGIOFP_READ_COMMAND		0
+#define	PIADAGIOFP_READ_EVENTS		1
+#define	PIADAGIOFP_IOC_SET_READ_MODE	_IOW(PIADAGIOFP_IOC_MAGIC, 0x07, __u32)
+
+#define	PIADAGIOFP_EVENT_ACTION		1				// Menu leaf selected: code = action ID, value = item index
+#define	PIADAGIOFP_EVENT_PRESS		2				// Button pressed (debounced): code = command
+#define	PIADAGIOFP_EVENT_LONG_PRESS	3				// Button held: code = command, value = time held (ms)
+#define	PIADAGIOFP_EVENT_REPEAT		4				// Button still held: code = command, value = repeat count
+#define	PIADAGIOFP_EVENT_RELEASE	5				// Button released: code = command, value = time held (ms)
+struct piadagio_fp_event {
+	__u16 type;							// PIADAGIOFP_EVENT_*
+	__u16 code;
+	__u32 value;
+};
+
+// Menu
+// Uploads a menu tree, which is then navigated by the driver using the
+// buttons (without any userspace involvement). Items are listed with
+// parents before their children, a level's items are shown in the order
+// they're listed. Selecting an item with no children queues a
+// PIADAGIOFP_EVENT_ACTION event. The firmware command codes for each
+// key are supplied with the menu.
+#define	PIADAGIOFP_MENU_MAX_ITEMS	128
+#define	PIADAGIOFP_MENU_ROOT		0xFFFF				// Parent of the top level items
+#define	PIADAGIOFP_MENU_LABEL_LEN	20				// Only the first 19 characters are shown
+struct piadagio_fp_menu_item {
+	__u16 parent;							// Index of the parent item, or PIADAGIOFP_MENU_ROOT
+	__u16 action;							// Action ID reported when selected (leaves only)
+	char label[PIADAGIOFP_MENU_LABEL_LEN];				// Not necessarily null terminated
+};
+struct piadagio_fp_menu {
+	__u32 count;							// Number of items
+	__u8 key_up;							// Firmware command codes for the keys
+	__u8 key_down;
+	__u8 key_select;
+	__u8 key_back;
+	__u64 items;							// Pointer to the items (struct piadagio_fp_menu_item)
+};
+#define	PIADAGIOFP_IOC_MENU_START	_IOW(PIADAGIOFP_IOC_MAGIC, 0x08, struct piadagio_fp_menu)
+#define	PIADAGIOFP_IOC_MENU_STOP	_IO(PIADAGIOFP_IOC_MAGIC, 0x09)
+
+// Big text
+// Renders a short string in large (3 x 2 character) digits, from the
+// given position (the top line can be 0 to 2). The string can contain
+// '0'-'9', ':', '.', '-' and ' ', digits/'-'/' ' are 4 columns wide and
+// ':'/'.' 2 columns (including the gap). The two lines are cleared from
+// the column onwards. The segment glyphs are loaded into the CGRAM.
+#define	PIADAGIOFP_BIG_TEXT_LEN		12
+struct piadagio_fp_big_text {
+	__u8 row;							// Top line (0 based)
+	__u8 col;							// First column (0 based)
+	__u8 reserved[2];
+	char text[PIADAGIOFP_BIG_TEXT_LEN];				// Null terminated, if shorter
+};
+#define	PIADAGIOFP_IOC_BIG_TEXT		_IOW(PIADAGIOFP_IOC_MAGIC, 0x0A, struct piadagio_fp_big_text)
+
+// Write mode
+// By default write() copies into the buffer selected by lseek, in text
+// mode it's a stream of characters and escape sequences written at a
+// cursor on the screen (see the README).
+#define	PIADAGIOFP_WRITE_BUFFER		0
+#define	PIADAGIOFP_WRITE_TEXT		1
+#define	PIADAGIOFP_IOC_SET_WRITE_MODE	_IOW(PIADAGIOFP_IOC_MAGIC, 0x0B, __u32)
+
+#endif
@@ -0,0 +1,662 @@
+// Buffer and packet encoding helpers
+// These only operate on the buffers passed to them (no i2c, locking, or
+// global state), so that the logic can be exercised independently of
+// the hardware.
+
+#define	BUFFER_OFFSET_GLYPH		128				// Start of the glyph buffer in the device memory map
+#define	BUFFER_OFFSET_CANVAS		256				// Start of the canvas buffer in the device memory map
+#define	PIADAGIOFP_MEMORY_LEN		(BUFFER_OFFSET_GLYPH + GLYPH_BUFFER_LEN)	// Screen and glyphs (the binary sysfs object)
+
+// Decode a device offset into which buffer it refers to, and the index
+// into that buffer.
+// Returns BUFFER_WRITE_CHAR/BUFFER_WRITE_GLYPH, or -EFAULT if the offset
+// is outside of the memory map.
+static inline int piadagio_fp_offset_decode(loff_t offset, unsigned int *index) {
+	if ((offset >= 0) && (offset < SCREEN_BUFFER_LEN)) {
+		*index = offset;
+		return BUFFER_WRITE_CHAR;
+	} else if ((offset >= BUFFER_OFFSET_GLYPH) && (offset < (BUFFER_OFFSET_GLYPH + GLYPH_BUFFER_LEN))) {
+		*index = offset - BUFFER_OFFSET_GLYPH;
+		return BUFFER_WRITE_GLYPH;
+	} else if ((offset >= BUFFER_OFFSET_CANVAS) && (offset < (BUFFER_OFFSET_CANVAS + CANVAS_BUFFER_LEN))) {
+		*index = offset - BUFFER_OFFSET_CANVAS;
+		return BUFFER_WRITE_CANVAS;
+	}
+
+	return -EFAULT;
+}
+
+// Returns the number of bytes that can be copied from index, before the
+// buffer wraps.
+static inline size_t piadagio_fp_buffer_chunk(unsigned int index, size_t count, unsigned int buffer_len) {
+	return min_t(size_t, count, (buffer_len - index));
+}
+
+// Advance a buffer index, wrapping at the end of the buffer
+static inline unsigned int piadagio_fp_buffer_advance(unsigned int index, size_t count, unsigned int buffer_len) {
+	return (index + count) % buffer_len;
+}
+
+// Flag the glyphs touched by a write of count bytes at index (no wrap)
+static inline void piadagio_fp_glyph_mark_range(bool *glyph_updated, unsigned int index, size_t count) {
+	unsigned int i;
+
+	if (count == 0) {
+		return;
+	}
+	for (i = (index / 8); i <= ((index + count - 1) / 8); i++) {
+		glyph_updated[i] = true;
+	}
+}
+
+// Step the button state machine with the command just read
+// Returns the event generated (PIADAGIOFP_EVENT_*, with code/value), or
+// 0 for none.
+static inline u16 piadagio_fp_button_step(struct piadagio_fp_button *button, unsigned int command, s64 now, u16 *code, u32 *value) {
+	switch (button->state) {
+	case PIADAGIOFP_BUTTON_IDLE:
+		if (command == 0) {
+			break;
+		}
+		button->state = PIADAGIOFP_BUTTON_DEBOUNCE;
+		button->code = command;
+		button->since = now;
+		fallthrough;						// No debounce, so may be pressed already
+	case PIADAGIOFP_BUTTON_DEBOUNCE:
+		if (command != button->code) {				// Bounced
+			if (command == 0) {
+				button->state = PIADAGIOFP_BUTTON_IDLE;
+			} else {
+				button->code = command;
+				button->since = now;
+			}
+			break;
+		}
+		if ((now - button->since) >= button->debounce) {
+			button->state = PIADAGIOFP_BUTTON_PRESSED;
+			button->since = now;
+			button->release = -1;
+			*code = button->code;
+			*value = 0;
+			return PIADAGIOFP_EVENT_PRESS;
+		}
+		break;
+	case PIADAGIOFP_BUTTON_PRESSED:
+	case PIADAGIOFP_BUTTON_LONG:
+		if (command != button->code) {				// Released, once it's stable
+			if (button->release < 0) {
+				button->release = now;
+			}
+			if ((now - button->release) >= button->debounce) {
+				button->state = PIADAGIOFP_BUTTON_IDLE;
+				*code = button->code;
+				*value = button->release - button->since;
+				return PIADAGIOFP_EVENT_RELEASE;
+			}
+			break;
+		}
+		button->release = -1;
+
+		if ((button->state == PIADAGIOFP_BUTTON_PRESSED) && (button->long_press > 0) &&
+				((now - button->since) >= button->long_press)) {
+			button->state = PIADAGIOFP_BUTTON_LONG;
+			button->next_repeat = now + button->repeat;
+			button->repeats = 0;
+			*code = button->code;
+			*value = now - button->since;
+			return PIADAGIOFP_EVENT_LONG_PRESS;
+		}
+		if ((button->state == PIADAGIOFP_BUTTON_LONG) && (button->repeat > 0) && (now >= button->next_repeat)) {
+			button->next_repeat += button->repeat;
+			if (button->next_repeat <= now) {			// Fallen behind, so don't burst
+				button->next_repeat = now + button->repeat;
+			}
+			button->repeats++;
+			*code = button->code;
+			*value = button->repeats;
+			return PIADAGIOFP_EVENT_REPEAT;
+		}
+		break;
+	}
+	return 0;
+}
+
+// Returns how long (ms) until the button state machine next needs
+// stepping, at most poll_max. Returns -1 when no button is down.
+static inline s64 piadagio_fp_button_next(const struct piadagio_fp_button *button, s64 now, s64 poll_max) {
+	s64 tmp_next = poll_max;
+
+	switch (button->state) {
+	case PIADAGIOFP_BUTTON_IDLE:
+		return -1;
+	case PIADAGIOFP_BUTTON_DEBOUNCE:
+		tmp_next = button->since + button->debounce - now;
+		break;
+	case PIADAGIOFP_BUTTON_PRESSED:
+		if (button->release >= 0) {
+			tmp_next = button->release + button->debounce - now;
+		} else if (button->long_press > 0) {
+			tmp_next = button->since + button->long_press - now;
+		}
+		break;
+	case PIADAGIOFP_BUTTON_LONG:
+		if (button->release >= 0) {
+			tmp_next = button->release + button->debounce - now;
+		} else if (button->repeat > 0) {
+			tmp_next = button->next_repeat - now;
+		}
+		break;
+	}
+	return clamp_t(s64, tmp_next, 0, poll_max);
+}
+
+// Update the glyph buffer from a complete glyph image (64 bytes)
+// Only the glyphs that change are flagged.
+// Returns whether any glyph changed.
+static inline bool piadagio_fp_glyph_update(struct piadagio_fp_glyphs *glyphs, bool *glyph_updated, const unsigned char *image) {
+	bool tmp_changed = false;
+	unsigned int i;
+
+	for (i = 0; i < 8; i++) {
+		if (memcmp(glyphs->glyph[i].pixel_line, &image[i * 8], 8) != 0) {
+			memcpy(glyphs->glyph[i].pixel_line, &image[i * 8], 8);
+			glyph_updated[i] = true;
+			tmp_changed = true;
+		}
+	}
+	return tmp_changed;
+}
+
+// Checks a glyph bank name is usable as a firmware file name
+// Only letters, numbers, '-' and '_' are allowed.
+static inline bool piadagio_fp_bank_name_valid(const char *name) {
+	unsigned int i;
+
+	for (i = 0; name[i] != 0; i++) {
+		if ((i >= (PIADAGIOFP_BANK_NAME_LEN - 1)) || !(isalnum(name[i]) || (name[i] == '-') || (name[i] == '_'))) {
+			return false;
+		}
+	}
+	return (i > 0);
+}
+
+// Big text segment glyphs (3 x 2 characters per digit)
+// The glyphs are used through their upper alias (8-15), so a screen
+// never contains a 0.
+#define	BIG_LT		0x8						// Top left corner
+#define	BIG_UB		0x9						// Upper bar
+#define	BIG_RT		0xa						// Top right corner
+#define	BIG_LL		0xb						// Lower left corner
+#define	BIG_LB		0xc						// Lower bar
+#define	BIG_LR		0xd						// Lower right corner
+#define	BIG_UMB		0xe						// Upper and middle bars
+#define	BIG_LMB		0xf						// Middle and lower bars
+#define	BIG_FB		0xff						// Full block (character ROM)
+#define	BIG_DOT		0xa5						// Centred dot (character ROM A00)
+
+static const unsigned char piadagio_fp_big_glyphs[GLYPH_BUFFER_LEN] = {
+	0x07, 0x0f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f,			// BIG_LT
+	0x1f, 0x1f, 0x1f, 0x00, 0x00, 0x00, 0x00, 0x00,			// BIG_UB
+	0x1c, 0x1e, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f,			// BIG_RT
+	0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x0f, 0x07,			// BIG_LL
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x1f, 0x1f, 0x1f,			// BIG_LB
+	0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1e, 0x1c,			// BIG_LR
+	0x1f, 0x1f, 0x1f, 0x00, 0x00, 0x00, 0x1f, 0x1f,			// BIG_UMB
+	0x1f, 0x00, 0x00, 0x00, 0x00, 0x1f, 0x1f, 0x1f,			// BIG_LMB
+};
+
+static const unsigned char piadagio_fp_big_digits[10][2][3] = {
+	{ { BIG_LT, BIG_UB, BIG_RT }, { BIG_LL, BIG_LB, BIG_LR } },	// 0
+	{ { BIG_UB, BIG_RT, ' ' }, { BIG_LB, BIG_FB, BIG_LB } },	// 1
+	{ { BIG_UMB, BIG_UMB, BIG_RT }, { BIG_LL, BIG_LMB, BIG_LMB } },	// 2
+	{ { BIG_UMB, BIG_UMB, BIG_RT }, { BIG_LMB, BIG_LMB, BIG_LR } },	// 3
+	{ { BIG_LL, BIG_LB, BIG_FB }, { ' ', ' ', BIG_FB } },		// 4
+	{ { BIG_FB, BIG_UMB, BIG_UMB }, { BIG_LMB, BIG_LMB, BIG_LR } },	// 5
+	{ { BIG_LT, BIG_UMB, BIG_UMB }, { BIG_LL, BIG_LMB, BIG_LR } },	// 6
+	{ { BIG_UB, BIG_UB, BIG_RT }, { ' ', ' ', BIG_FB } },		// 7
+	{ { BIG_LT, BIG_UMB, BIG_RT }, { BIG_LL, BIG_LMB, BIG_LR } },	// 8
+	{ { BIG_LT, BIG_UMB, BIG_RT }, { ' ', ' ', BIG_FB } },		// 9
+};
+
+// Returns the width (columns) of a string in big text, or -1 if it
+// contains a character that can't be drawn.
+static inline int piadagio_fp_big_width(const char *text, size_t len) {
+	int tmp_width = 0;
+	size_t i;
+
+	for (i = 0; (i < len) && (text[i] != 0); i++) {
+		if (((text[i] >= '0') && (text[i] <= '9')) || (text[i] == '-') || (text[i] == ' ')) {
+			tmp_width += 4;
+		} else if ((text[i] == ':') || (text[i] == '.')) {
+			tmp_width += 2;
+		} else {
+			return -1;
+		}
+	}
+	return tmp_width;
+}
+
+// Draw a string in big text on two lines (from the start of top/bottom)
+// The string must have been checked with piadagio_fp_big_width().
+static inline void piadagio_fp_big_render(char *top, char *bottom, const char *text, size_t len) {
+	unsigned int tmp_col = 0;
+	size_t i;
+
+	for (i = 0; (i < len) && (text[i] != 0); i++) {
+		if ((text[i] >= '0') && (text[i] <= '9')) {
+			memcpy(&top[tmp_col], piadagio_fp_big_digits[text[i] - '0'][0], 3);
+			memcpy(&bottom[tmp_col], piadagio_fp_big_digits[text[i] - '0'][1], 3);
+			tmp_col += 4;
+		} else if (text[i] == '-') {
+			memset(&top[tmp_col], BIG_LB, 3);
+			tmp_col += 4;
+		} else if (text[i] == ' ') {
+			tmp_col += 4;
+		} else if (text[i] == ':') {
+			top[tmp_col] = BIG_DOT;
+			bottom[tmp_col] = BIG_DOT;
+			tmp_col += 2;
+		} else if (text[i] == '.') {
+			bottom[tmp_col] = BIG_DOT;
+			tmp_col += 2;
+		}
+	}
+}
+
+// Common panel geometries
+// The screen routines are specialised for these (see
+// PIADAGIOFP_GEOMETRY_DISPATCH), so their loops unroll and the copies
+// are constant sized.
+static const struct piadagio_fp_geometry piadagio_fp_geometry_20x4 = {
+	.kind	= PIADAGIOFP_GEOMETRY_20X4,
+	.rows	= 4,
+	.cols	= 20,
+	.half	= { PIADAGIOFP_SCREEN_HALF_1, PIADAGIOFP_SCREEN_HALF_2, PIADAGIOFP_SCREEN_HALF_1, PIADAGIOFP_SCREEN_HALF_2 },
+	.slot	= { 0, 0, 1, 1 },
+	.halves	= PIADAGIOFP_SCREEN_HALVES,
+};
+static const struct piadagio_fp_geometry piadagio_fp_geometry_16x2 = {
+	.kind	= PIADAGIOFP_GEOMETRY_16X2,
+	.rows	= 2,
+	.cols	= 16,
+	.half	= { PIADAGIOFP_SCREEN_HALF_1, PIADAGIOFP_SCREEN_HALF_2 },
+	.slot	= { 0, 0 },
+	.halves	= PIADAGIOFP_SCREEN_HALVES,
+};
+static const struct piadagio_fp_geometry piadagio_fp_geometry_40x2 = {
+	.kind	= PIADAGIOFP_GEOMETRY_40X2,
+	.rows	= 2,
+	.cols	= 40,
+	.half	= { PIADAGIOFP_SCREEN_HALF_1, PIADAGIOFP_SCREEN_HALF_2 },
+	.slot	= { 0, 0 },
+	.halves	= PIADAGIOFP_SCREEN_HALVES,
+};
+static const struct piadagio_fp_geometry *piadagio_fp_geometries[] = {
+	&piadagio_fp_geometry_20x4,
+	&piadagio_fp_geometry_16x2,
+	&piadagio_fp_geometry_40x2,
+};
+
+// Calls (returning the result of) a _geo routine, with the constant
+// geometry when it's a common one, otherwise the panel's own.
+#define	PIADAGIOFP_GEOMETRY_DISPATCH(geo, fn, ...)				\
+	switch ((geo)->kind) {							\
+	case PIADAGIOFP_GEOMETRY_20X4:						\
+		return fn(&piadagio_fp_geometry_20x4, __VA_ARGS__);		\
+	case PIADAGIOFP_GEOMETRY_16X2:						\
+		return fn(&piadagio_fp_geometry_16x2, __VA_ARGS__);		\
+	case PIADAGIOFP_GEOMETRY_40X2:						\
+		return fn(&piadagio_fp_geometry_40x2, __VA_ARGS__);		\
+	default:								\
+		return fn((geo), __VA_ARGS__);					\
+	}
+
+// Work out a panel geometry
+// The interleave lists the rows in the order they're sent, the first
+// half of the list in screen half 1 (DDRAM 0x00), the rest in half 2
+// (DDRAM 0x40). Without one, rows alternate between the halves (the
+// usual HD44780 layout, 1 & 3 then 2 & 4 on a 4 line panel).
+// Returns 0, or -EINVAL if the geometry can't be driven.
+static inline int piadagio_fp_geometry_init(struct piadagio_fp_geometry *geo, unsigned int rows, unsigned int cols, const u8 *interleave) {
+	unsigned int tmp_slots = DIV_ROUND_UP(rows, 2);			// Rows per half
+	unsigned int i, tmp_row;
+	u8 tmp_seen = 0;
+
+	if ((rows == 0) || (rows > PIADAGIOFP_ROWS_MAX) || (cols == 0) ||
+			((rows * cols) > SCREEN_BUFFER_LEN) || ((tmp_slots * cols) > (2 * LCD_LINE_LEN))) {
+		return -EINVAL;
+	}
+
+	memset(geo, 0, sizeof(*geo));
+	geo->kind = PIADAGIOFP_GEOMETRY_CUSTOM;
+	geo->rows = rows;
+	geo->cols = cols;
+	for (i = 0; i < rows; i++) {
+		if (interleave) {
+			tmp_row = interleave[i];
+			if ((tmp_row >= rows) || (tmp_seen & (1 << tmp_row))) {
+				return -EINVAL;
+			}
+			tmp_seen |= (1 << tmp_row);
+		} else {
+			tmp_row = ((i % tmp_slots) * 2) + (i / tmp_slots);
+		}
+		geo->half[tmp_row] = (i < tmp_slots) ? PIADAGIOFP_SCREEN_HALF_1 : PIADAGIOFP_SCREEN_HALF_2;
+		geo->slot[tmp_row] = i % tmp_slots;
+		geo->halves |= geo->half[tmp_row];
+	}
+
+	// Use the fast path, if there is one
+	for (i = 0; i < ARRAY_SIZE(piadagio_fp_geometries); i++) {
+		if ((piadagio_fp_geometries[i]->rows == rows) && (piadagio_fp_geometries[i]->cols == cols) &&
+				(memcmp(piadagio_fp_geometries[i]->half, geo->half, rows) == 0) &&
+				(memcmp(piadagio_fp_geometries[i]->slot, geo->slot, rows) == 0)) {
+			geo->kind = piadagio_fp_geometries[i]->kind;
+		}
+	}
+	return 0;
+}
+
+// Compare a screen (in memory map order) with the screen buffer
+// Returns the screen halves that differ (PIADAGIOFP_SCREEN_HALF_*).
+static __always_inline u8 piadagio_fp_screen_diff_geo(const struct piadagio_fp_geometry *geo, const struct piadagio_fp_char_buffer *screen, const unsigned char *new_screen) {
+	unsigned int i, tmp_offset;
+	u8 halves = 0;
+
+	for (i = 0; i < geo->rows; i++) {
+		tmp_offset = i * geo->cols;
+		if (memcmp(&screen->chars[tmp_offset], &new_screen[tmp_offset], geo->cols) != 0) {
+			halves |= geo->half[i];
+		}
+	}
+	return halves;
+}
+
+static inline u8 piadagio_fp_screen_diff(const struct piadagio_fp_geometry *geo, const struct piadagio_fp_char_buffer *screen, const unsigned char *new_screen) {
+	PIADAGIOFP_GEOMETRY_DISPATCH(geo, piadagio_fp_screen_diff_geo, screen, new_screen);
+}
+
+// Fill the screen buffer from a splash string
+// Lines are separated by '|', each is truncated to the line length and
+// padded with spaces. Any lines past the last row are ignored.
+static inline void piadagio_fp_splash_render(const struct piadagio_fp_geometry *geo, struct piadagio_fp_char_buffer *screen, const char *text) {
+	unsigned int line = 0, col = 0;
+
+	memset(screen->chars, ' ', SCREEN_BUFFER_LEN);
+	for (; (*text != 0) && (line < geo->rows); text++) {
+		if (*text == '|') {
+			line++;
+			col = 0;
+		} else if (col < geo->cols) {
+			screen->chars[(line * geo->cols) + col] = *text;
+			col++;
+		}
+	}
+}
+
+// Clear part of a screen line to spaces (columns from, up to to)
+static inline void piadagio_fp_text_clear(const struct piadagio_fp_geometry *geo, struct piadagio_fp_char_buffer *screen, unsigned int row, unsigned int from, unsigned int to) {
+	memset(&screen->chars[(row * geo->cols) + from], ' ', to - from);
+}
+
+// Handle the end of a CSI sequence (ESC [ params final)
+// Returns PIADAGIOFP_TEXT_CHANGED if the screen changed.
+static inline u8 piadagio_fp_text_csi(const struct piadagio_fp_geometry *geo, struct piadagio_fp_text *text, struct piadagio_fp_char_buffer *screen, unsigned char final) {
+	unsigned int tmp_param = text->params[0];
+
+	switch (final) {
+	case 'H':								// Cursor position (1 based row;col)
+	case 'f':
+		text->row = clamp_t(unsigned int, text->params[0], 1, geo->rows) - 1;
+		text->col = clamp_t(unsigned int, text->params[1], 1, geo->cols) - 1;
+		return 0;
+	case 'J':								// Clear the screen (and home the cursor)
+		if (tmp_param != 2) {
+			return 0;
+		}
+		memset(screen->chars, ' ', SCREEN_BUFFER_LEN);
+		text->row = 0;
+		text->col = 0;
+		return PIADAGIOFP_TEXT_CHANGED;
+	case 'K':								// Clear (part of) the line
+		if (tmp_param == 0) {
+			piadagio_fp_text_clear(geo, screen, text->row, text->col, geo->cols);
+		} else if (tmp_param == 1) {
+			piadagio_fp_text_clear(geo, screen, text->row, 0, text->col + 1);
+		} else if (tmp_param == 2) {
+			piadagio_fp_text_clear(geo, screen, text->row, 0, geo->cols);
+		} else {
+			return 0;
+		}
+		return PIADAGIOFP_TEXT_CHANGED;
+	}
+	return 0;								// Unsupported, ignored
+}
+
+// Feed a character to the text mode parser
+// Printable characters are written at the cursor (characters past the
+// end of the line are dropped), glyphs 0-7 are written as their 8-15
+// alias. Control characters:
+//	\b - back one column	\r - start of the line
+//	\n - clear the rest of the line, and move to the start of the next
+//	\f - commit the screen
+// Escape sequences:
+//	ESC [ H / ESC [ r;c H	- Move the cursor (1 based)
+//	ESC [ K / 1K / 2K	- Clear to the end/start/all of the line
+//	ESC [ 2J		- Clear the screen and home the cursor
+//	ESC [ L G n hex... ;	- Define glyph n (up to 16 hex digits, a byte per pixel line)
+// Returns PIADAGIOFP_TEXT_CHANGED and/or PIADAGIOFP_TEXT_COMMIT.
+static inline u8 piadagio_fp_text_feed(const struct piadagio_fp_geometry *geo, struct piadagio_fp_text *text, struct piadagio_fp_char_buffer *screen, struct piadagio_fp_glyphs *glyphs, bool *glyph_updated, unsigned char c) {
+	int tmp_nibble;
+
+	switch (text->state) {
+	case PIADAGIOFP_TEXT_ESC:
+		if (c == '[') {
+			text->state = PIADAGIOFP_TEXT_CSI;
+			text->nparams = 0;
+			text->params[0] = 0;
+			text->params[1] = 0;
+		} else {
+			text->state = PIADAGIOFP_TEXT_NORMAL;			// Unsupported
+		}
+		return 0;
+	case PIADAGIOFP_TEXT_CSI:
+		if ((c >= '0') && (c <= '9')) {
+			if (text->nparams == 0) {
+				text->nparams = 1;
+			}
+			if (text->params[text->nparams - 1] < 1000) {
+				text->params[text->nparams - 1] = (text->params[text->nparams - 1] * 10) + (c - '0');
+			}
+		} else if (c == ';') {
+			text->nparams = 2;					// On to the column (the row can be omitted)
+		} else if ((c == 'L') && (text->nparams == 0)) {
+			text->state = PIADAGIOFP_TEXT_LCD;
+		} else {
+			text->state = PIADAGIOFP_TEXT_NORMAL;
+			return piadagio_fp_text_csi(geo, text, screen, c);
+		}
+		return 0;
+	case PIADAGIOFP_TEXT_LCD:
+		text->state = (c == 'G') ? PIADAGIOFP_TEXT_GLYPH_INDEX : PIADAGIOFP_TEXT_NORMAL;
+		return 0;
+	case PIADAGIOFP_TEXT_GLYPH_INDEX:
+		if ((c >= '0') && (c <= '7')) {
+			text->glyph_index = c - '0';
+			text->glyph_nibbles = 0;
+			memset(text->glyph, 0, 8);
+			text->state = PIADAGIOFP_TEXT_GLYPH_DATA;
+		} else {
+			text->state = PIADAGIOFP_TEXT_NORMAL;
+		}
+		return 0;
+	case PIADAGIOFP_TEXT_GLYPH_DATA:
+		if (c == ';') {
+			if (memcmp(glyphs->glyph[text->glyph_index].pixel_line, text->glyph, 8) != 0) {
+				memcpy(glyphs->glyph[text->glyph_index].pixel_line, text->glyph, 8);
+				glyph_updated[text->glyph_index] = true;
+			}
+			text->state = PIADAGIOFP_TEXT_NORMAL;
+			return 0;
+		}
+		tmp_nibble = hex_to_bin(c);
+		if (tmp_nibble < 0) {
+			text->state = PIADAGIOFP_TEXT_NORMAL;			// Malformed, drop it
+		} else if (text->glyph_nibbles < 16) {
+			text->glyph[text->glyph_nibbles / 2] = (text->glyph[text->glyph_nibbles / 2] << 4) | tmp_nibble;
+			text->glyph_nibbles++;
+		}
+		return 0;
+	}
+
+	switch (c) {
+	case 0x1b:
+		text->state = PIADAGIOFP_TEXT_ESC;
+		return 0;
+	case '\b':
+		if (text->col > 0) {
+			text->col--;
+		}
+		return 0;
+	case '\r':
+		text->col = 0;
+		return 0;
+	case '\n':
+		if (text->col < geo->cols) {
+			piadagio_fp_text_clear(geo, screen, text->row, text->col, geo->cols);
+		}
+		text->row = (text->row + 1) % geo->rows;
+		text->col = 0;
+		return PIADAGIOFP_TEXT_CHANGED;
+	case '\f':
+		return PIADAGIOFP_TEXT_COMMIT;
+	}
+	if (c < 0x8) {								// Glyph, use the upper alias
+		c += 0x8;
+	} else if (c < ' ') {							// Other control characters are ignored
+		return 0;
+	}
+	if (text->col < geo->cols) {
+		screen->chars[(text->row * geo->cols) + text->col] = c;
+		text->col++;
+		return PIADAGIOFP_TEXT_CHANGED;
+	}
+	return 0;
+}
+
+// Last line of the canvas the viewport can start at
+// Canvas lines are the panel's width.
+static inline unsigned int piadagio_fp_canvas_viewport_max(const struct piadagio_fp_geometry *geo) {
+	return (CANVAS_BUFFER_LEN / geo->cols) - geo->rows;
+}
+
+// Copy the canvas lines visible from the viewport into the screen buffer
+// Returns the screen halves that changed.
+static inline u8 piadagio_fp_canvas_project(const struct piadagio_fp_geometry *geo, struct piadagio_fp_char_buffer *screen, const char *canvas, unsigned int viewport) {
+	const unsigned char *tmp_lines = (const unsigned char *) &canvas[viewport * geo->cols];
+	u8 halves;
+
+	halves = piadagio_fp_screen_diff(geo, screen, tmp_lines);
+	if (halves) {
+		memcpy(screen->chars, tmp_lines, geo->rows * geo->cols);
+	}
+	return halves;
+}
+
+// Record a screen half the panel has acknowledged (from the message sent)
+// Returns the half.
+static __always_inline u8 piadagio_fp_shadow_store_screen_geo(const struct piadagio_fp_geometry *geo, struct piadagio_fp_shadow *shadow, const unsigned char *msg) {
+	u8 tmp_half = (msg[2] == 0x0) ? PIADAGIOFP_SCREEN_HALF_1 : PIADAGIOFP_SCREEN_HALF_2;
+	unsigned int i;
+
+	for (i = 0; i < geo->rows; i++) {
+		if (geo->half[i] == tmp_half) {
+			memcpy(&shadow->screen.chars[i * geo->cols], &msg[3 + (geo->slot[i] * geo->cols)], geo->cols);
+		}
+	}
+	shadow->screen_valid |= tmp_half;
+	return tmp_half;
+}
+
+static inline u8 piadagio_fp_shadow_store_screen(const struct piadagio_fp_geometry *geo, struct piadagio_fp_shadow *shadow, const unsigned char *msg) {
+	PIADAGIOFP_GEOMETRY_DISPATCH(geo, piadagio_fp_shadow_store_screen_geo, shadow, msg);
+}
+
+// Returns the screen halves that differ from the panel (or aren't known)
+static inline u8 piadagio_fp_shadow_screen_diff(const struct piadagio_fp_geometry *geo, const struct piadagio_fp_shadow *shadow, const struct piadagio_fp_char_buffer *screen) {
+	return piadagio_fp_screen_diff(geo, &shadow->screen, (const unsigned char *) screen->chars) |
+		(~shadow->screen_valid & geo->halves);
+}
+
+// Checks whether the panel already has a glyph
+static inline bool piadagio_fp_shadow_glyph_current(const struct piadagio_fp_shadow *shadow, unsigned char glyph_index, const struct piadagio_fp_glyph *glyph) {
+	return (shadow->cgram_valid & (1 << glyph_index)) &&
+		(memcmp(shadow->cgram.glyph[glyph_index].pixel_line, glyph->pixel_line, 8) == 0);
+}
+
+// Encode the command to update half of the screen
+// Each row is placed at its slot in its half (on a 20x4 panel, lines
+// 1 & 3, then 2 & 4), any unused space is padded with spaces.
+// Returns the message length.
+static __always_inline unsigned int piadagio_fp_encode_screen_geo(const struct piadagio_fp_geometry *geo, unsigned char *msg, const struct piadagio_fp_char_buffer *screen, bool other_half) {
+	u8 tmp_half = other_half ? PIADAGIOFP_SCREEN_HALF_2 : PIADAGIOFP_SCREEN_HALF_1;
+	unsigned int i;
+
+	msg[0] = I2C_MSG_LEN_UPDATE_LCD - 1;					// Message length doesn't include this byte
+	msg[1] = I2C_MSG_TYPE_CHAR;						// Screen write cmd
+	msg[2] = other_half ? 0x1 : 0x0;					// Screen write position
+	if ((geo->rows & 1) || (((geo->rows / 2) * geo->cols) != (2 * LCD_LINE_LEN))) {
+		memset(&msg[3], ' ', (2 * LCD_LINE_LEN));			// Rows don't fill the half
+	}
+	for (i = 0; i < geo->rows; i++) {
+		if (geo->half[i] == tmp_half) {
+			memcpy(&msg[3 + (geo->slot[i] * geo->cols)], &screen->chars[i * geo->cols], geo->cols);
+		}
+	}
+	return I2C_MSG_LEN_UPDATE_LCD;
+}
+
+static inline unsigned int piadagio_fp_encode_screen(const struct piadagio_fp_geometry *geo, unsigned char *msg, const struct piadagio_fp_char_buffer *screen, bool other_half) {
+	PIADAGIOFP_GEOMETRY_DISPATCH(geo, piadagio_fp_encode_screen_geo, msg, screen, other_half);
+}
+
+// Encode the command to update a CGRAM glyph
+// Returns the message length.
+static inline unsigned int piadagio_fp_encode_glyph(unsigned char *msg, unsigned char glyph_index, const struct piadagio_fp_glyph *glyph) {
+	msg[0] = I2C_MSG_LEN_UPDATE_CGRAM - 1;					// Message length, not including this byte
+	msg[1] = I2C_MSG_TYPE_GLYPH;						// Glyph update cmd
+	msg[2] = glyph_index;
+	memcpy(&msg[3], glyph->pixel_line, 8);
+	return I2C_MSG_LEN_UPDATE_CGRAM;
+}
+
+// Encode the command to update the LEDs
+// Returns the message length.
+static inline unsigned int piadagio_fp_encode_leds(unsigned char *msg, unsigned short led_online, unsigned short led_power) {
+	msg[0] = I2C_MSG_LEN_UPDATE_LED - 1;					// Message length, not including this byte
+	msg[1] = I2C_MSG_TYPE_LED;						// LED update cmd
+	msg[2] = 0;								// LED status bits
+	if (led_online > 0) {
+		msg[2] |= 2;
+	}
+	if (led_power > 0) {
+		msg[2] |= 1;
+	}
+	return I2C_MSG_LEN_UPDATE_LED;
+}
+
+// Checks whether the panel LEDs are already set
+static inline bool piadagio_fp_shadow_leds_current(const struct piadagio_fp_shadow *shadow, unsigned short led_online, unsigned short led_power) {
+	unsigned char tmp_msg[I2C_MSG_LEN_UPDATE_LED];
+
+	piadagio_fp_encode_leds(&tmp_msg[0], led_online, led_power);
+	return shadow->leds_valid && (shadow->leds == tmp_msg[2]);
+}
+
+// Encode the command to clear the screen
+// Returns the message length.
+static inline unsigned int piadagio_fp_encode_clear(unsigned char *msg) {
+	msg[0] = I2C_MSG_LEN_CLEAR - 1;						// Message length, not including this byte
+	msg[1] = I2C_MSG_TYPE_CLEAR;						// Clear screen cmd
+	return I2C_MSG_LEN_CLEAR;
+}
@@ -0,0 +1,25 @@
+// Adagio-PIC-FP i2c protocol definitions
+// Shared by the front panel driver, and the front panel emulator.
+//
+// Reading 2 bytes from the FP returns:
+//	1. FP status byte (< 2 ready for another command, otherwise busy)
+//	2. FP command byte (currently depressed button)
+//
+// Writing to the FP sends a command:
+//	length (not including this byte) + message type + payload
+
+#define	PIADAGIOFP_I2C_ADDR	0x11
+
+#define	I2C_MSG_TYPE_CLEAR	0x1					// Clear screen
+#define	I2C_MSG_TYPE_CHAR	0x2					// Write characters to lcd
+#define	I2C_MSG_TYPE_GLYPH	0x4					// Update user defined fonts
+#define	I2C_MSG_TYPE_LED	0x8					// Control leds
+
+#define	I2C_FP_STATUS_READY	0x0					// FP ready for another command
+#define	I2C_FP_STATUS_BUSY	0x2					// FP processing existing command
+
+#define LCD_LINE_LEN		0x14
+#define	I2C_MSG_LEN_CLEAR		2				// Size of command to clear the screen
+#define	I2C_MSG_LEN_UPDATE_CGRAM	11				// Size of command to update 1 CGRAM glyph
+#define I2C_MSG_LEN_UPDATE_LED		3				// Size of command to update the LEDs
+#define I2C_MSG_LEN_UPDATE_LCD		((LCD_LINE_LEN * 2) + 3)	// Size of command to update half the lcd (This is the maximum msg size)
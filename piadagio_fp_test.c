@@ -0,0 +1,685 @@
+////////////////////////////////////////////////////////////////////
+//
+// piadagio_fp_test
+// KUnit tests for the buffer and packet encoding helpers
+// (piadagio_fp_lib.h), along with microbenchmarks of the write path and
+// the per frame encoding cost.
+//
+// Build against a kernel with CONFIG_KUNIT, then load the module to
+// run the suite (results are reported in the kernel log, as KTAP):
+//	insmod piadagio_fp_test.ko
+// Or, with the driver in a kernel tree, run it under UML with:
+//	./tools/testing/kunit/kunit.py run --kunitconfig=<path to this directory>
+//
+////////////////////////////////////////////////////////////////////
+#include <kunit/test.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/ctype.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/i2c.h>
+#include <linux/mutex.h>
+#include <linux/rwsem.h>
+#include <linux/device.h>
+#include <linux/fs.h>
+#include <linux/cdev.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+#include <linux/hrtimer.h>
+#include <linux/kfifo.h>
+#include <linux/leds.h>
+#include <linux/atomic.h>
+#define PIADAGIOFP_KUNIT_TEST
+#include "piadagio_fp.h"
+#include "piadagio_fp_lib.h"
+
+#define PIADAGIOFP_BENCH_WRITE_LEN	(1024 * 1024)			// Bytes written by the write path benchmark
+#define PIADAGIOFP_BENCH_WRITE_CHUNK	4096				// Size of each write
+#define PIADAGIOFP_BENCH_FRAMES		10000				// Frames encoded by the frame benchmark
+
+// Fill a screen buffer, each row with its own character (row 0 = 'A')
+static void piadagio_fp_test_fill_rows(const struct piadagio_fp_geometry *geo, struct piadagio_fp_char_buffer *screen) {
+	unsigned int i;
+
+	memset(screen->chars, ' ', SCREEN_BUFFER_LEN);
+	for (i = 0; i < geo->rows; i++) {
+		memset(&screen->chars[i * geo->cols], 'A' + i, geo->cols);
+	}
+}
+
+// Checks that count bytes at p are all c
+static bool piadagio_fp_test_all(const unsigned char *p, unsigned char c, size_t count) {
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		if (p[i] != c) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Feed a string to the text mode parser
+// Returns the results of all the characters combined.
+static u8 piadagio_fp_test_text(const struct piadagio_fp_geometry *geo, struct piadagio_fp_text *text, struct piadagio_fp_char_buffer *screen,
+				struct piadagio_fp_glyphs *glyphs, bool *glyph_updated, const char *s) {
+	u8 tmp_result = 0;
+
+	for (; *s != 0; s++) {
+		tmp_result |= piadagio_fp_text_feed(geo, text, screen, glyphs, glyph_updated, *s);
+	}
+	return tmp_result;
+}
+
+////////////////////////////////////////////////////////////////////
+// Memory map
+////////////////////////////////////////////////////////////////////
+static void piadagio_fp_test_offset_decode(struct kunit *test) {
+	unsigned int tmp_index = 0;
+
+	KUNIT_EXPECT_EQ(test, piadagio_fp_offset_decode(0, &tmp_index), BUFFER_WRITE_CHAR);
+	KUNIT_EXPECT_EQ(test, tmp_index, 0U);
+	KUNIT_EXPECT_EQ(test, piadagio_fp_offset_decode(79, &tmp_index), BUFFER_WRITE_CHAR);
+	KUNIT_EXPECT_EQ(test, tmp_index, 79U);
+	KUNIT_EXPECT_EQ(test, piadagio_fp_offset_decode(80, &tmp_index), -EFAULT);
+	KUNIT_EXPECT_EQ(test, piadagio_fp_offset_decode(127, &tmp_index), -EFAULT);
+
+	KUNIT_EXPECT_EQ(test, piadagio_fp_offset_decode(128, &tmp_index), BUFFER_WRITE_GLYPH);
+	KUNIT_EXPECT_EQ(test, tmp_index, 0U);
+	KUNIT_EXPECT_EQ(test, piadagio_fp_offset_decode(191, &tmp_index), BUFFER_WRITE_GLYPH);
+	KUNIT_EXPECT_EQ(test, tmp_index, 63U);
+	KUNIT_EXPECT_EQ(test, piadagio_fp_offset_decode(192, &tmp_index), -EFAULT);
+	KUNIT_EXPECT_EQ(test, piadagio_fp_offset_decode(255, &tmp_index), -EFAULT);
+
+	KUNIT_EXPECT_EQ(test, piadagio_fp_offset_decode(BUFFER_OFFSET_CANVAS, &tmp_index), BUFFER_WRITE_CANVAS);
+	KUNIT_EXPECT_EQ(test, tmp_index, 0U);
+	KUNIT_EXPECT_EQ(test, piadagio_fp_offset_decode(BUFFER_OFFSET_CANVAS + CANVAS_BUFFER_LEN - 1, &tmp_index), BUFFER_WRITE_CANVAS);
+	KUNIT_EXPECT_EQ(test, tmp_index, (unsigned int) (CANVAS_BUFFER_LEN - 1));
+	KUNIT_EXPECT_EQ(test, piadagio_fp_offset_decode(BUFFER_OFFSET_CANVAS + CANVAS_BUFFER_LEN, &tmp_index), -EFAULT);
+
+	KUNIT_EXPECT_EQ(test, piadagio_fp_offset_decode(-1, &tmp_index), -EFAULT);
+}
+
+static void piadagio_fp_test_buffer_wrap(struct kunit *test) {
+	unsigned int tmp_index = 70;
+	size_t tmp_count = 200, tmp_chunk;
+	size_t tmp_chunks[4];
+	unsigned int i = 0;
+
+	KUNIT_EXPECT_EQ(test, piadagio_fp_buffer_chunk(0, 10, SCREEN_BUFFER_LEN), (size_t) 10);
+	KUNIT_EXPECT_EQ(test, piadagio_fp_buffer_chunk(70, 20, SCREEN_BUFFER_LEN), (size_t) 10);
+	KUNIT_EXPECT_EQ(test, piadagio_fp_buffer_chunk(79, 1, SCREEN_BUFFER_LEN), (size_t) 1);
+	KUNIT_EXPECT_EQ(test, piadagio_fp_buffer_advance(10, 5, SCREEN_BUFFER_LEN), 15U);
+	KUNIT_EXPECT_EQ(test, piadagio_fp_buffer_advance(79, 1, SCREEN_BUFFER_LEN), 0U);
+	KUNIT_EXPECT_EQ(test, piadagio_fp_buffer_advance(60, 4, GLYPH_BUFFER_LEN), 0U);
+
+	// A write bigger than the buffer, as the write path copies it
+	while (tmp_count && (i < ARRAY_SIZE(tmp_chunks))) {
+		tmp_chunk = piadagio_fp_buffer_chunk(tmp_index, tmp_count, SCREEN_BUFFER_LEN);
+		tmp_chunks[i++] = tmp_chunk;
+		tmp_count -= tmp_chunk;
+		tmp_index = piadagio_fp_buffer_advance(tmp_index, tmp_chunk, SCREEN_BUFFER_LEN);
+	}
+	KUNIT_EXPECT_EQ(test, tmp_count, (size_t) 0);
+	KUNIT_EXPECT_EQ(test, i, 4U);
+	KUNIT_EXPECT_EQ(test, tmp_chunks[0], (size_t) 10);
+	KUNIT_EXPECT_EQ(test, tmp_chunks[1], (size_t) 80);
+	KUNIT_EXPECT_EQ(test, tmp_chunks[2], (size_t) 80);
+	KUNIT_EXPECT_EQ(test, tmp_chunks[3], (size_t) 30);
+	KUNIT_EXPECT_EQ(test, tmp_index, 30U);
+}
+
+static void piadagio_fp_test_glyph_mark_range(struct kunit *test) {
+	bool tmp_updated[8] = { false };
+
+	piadagio_fp_glyph_mark_range(tmp_updated, 6, 0);
+	KUNIT_EXPECT_FALSE(test, tmp_updated[0]);
+
+	piadagio_fp_glyph_mark_range(tmp_updated, 6, 4);		// Spans glyphs 0 & 1
+	KUNIT_EXPECT_TRUE(test, tmp_updated[0]);
+	KUNIT_EXPECT_TRUE(test, tmp_updated[1]);
+	KUNIT_EXPECT_FALSE(test, tmp_updated[2]);
+
+	piadagio_fp_glyph_mark_range(tmp_updated, 63, 1);
+	KUNIT_EXPECT_TRUE(test, tmp_updated[7]);
+	KUNIT_EXPECT_FALSE(test, tmp_updated[6]);
+}
+
+////////////////////////////////////////////////////////////////////
+// Geometry
+////////////////////////////////////////////////////////////////////
+static void piadagio_fp_test_geometry_init(struct kunit *test) {
+	struct piadagio_fp_geometry tmp_geo;
+	static const u8 tmp_in_order[4] = { 0, 1, 2, 3 };
+	static const u8 tmp_repeated[4] = { 0, 1, 1, 3 };
+
+	// The common sizes get their fast paths
+	KUNIT_EXPECT_EQ(test, piadagio_fp_geometry_init(&tmp_geo, 4, 20, NULL), 0);
+	KUNIT_EXPECT_EQ(test, tmp_geo.kind, (u8) PIADAGIOFP_GEOMETRY_20X4);
+	KUNIT_EXPECT_EQ(test, tmp_geo.half[0], (u8) PIADAGIOFP_SCREEN_HALF_1);
+	KUNIT_EXPECT_EQ(test, tmp_geo.half[1], (u8) PIADAGIOFP_SCREEN_HALF_2);
+	KUNIT_EXPECT_EQ(test, tmp_geo.half[2], (u8) PIADAGIOFP_SCREEN_HALF_1);
+	KUNIT_EXPECT_EQ(test, tmp_geo.slot[2], (u8) 1);
+	KUNIT_EXPECT_EQ(test, piadagio_fp_geometry_init(&tmp_geo, 2, 16, NULL), 0);
+	KUNIT_EXPECT_EQ(test, tmp_geo.kind, (u8) PIADAGIOFP_GEOMETRY_16X2);
+	KUNIT_EXPECT_EQ(test, piadagio_fp_geometry_init(&tmp_geo, 2, 40, NULL), 0);
+	KUNIT_EXPECT_EQ(test, tmp_geo.kind, (u8) PIADAGIOFP_GEOMETRY_40X2);
+
+	// A single row only uses the first half
+	KUNIT_EXPECT_EQ(test, piadagio_fp_geometry_init(&tmp_geo, 1, 20, NULL), 0);
+	KUNIT_EXPECT_EQ(test, tmp_geo.kind, (u8) PIADAGIOFP_GEOMETRY_CUSTOM);
+	KUNIT_EXPECT_EQ(test, tmp_geo.halves, (u8) PIADAGIOFP_SCREEN_HALF_1);
+
+	// Rows in order, 1 & 2 in the first half
+	KUNIT_EXPECT_EQ(test, piadagio_fp_geometry_init(&tmp_geo, 4, 20, tmp_in_order), 0);
+	KUNIT_EXPECT_EQ(test, tmp_geo.kind, (u8) PIADAGIOFP_GEOMETRY_CUSTOM);
+	KUNIT_EXPECT_EQ(test, tmp_geo.half[1], (u8) PIADAGIOFP_SCREEN_HALF_1);
+	KUNIT_EXPECT_EQ(test, tmp_geo.slot[1], (u8) 1);
+	KUNIT_EXPECT_EQ(test, tmp_geo.half[2], (u8) PIADAGIOFP_SCREEN_HALF_2);
+	KUNIT_EXPECT_EQ(test, tmp_geo.slot[2], (u8) 0);
+
+	// Geometries that can't be driven
+	KUNIT_EXPECT_EQ(test, piadagio_fp_geometry_init(&tmp_geo, 0, 20, NULL), -EINVAL);
+	KUNIT_EXPECT_EQ(test, piadagio_fp_geometry_init(&tmp_geo, 5, 16, NULL), -EINVAL);
+	KUNIT_EXPECT_EQ(test, piadagio_fp_geometry_init(&tmp_geo, 4, 0, NULL), -EINVAL);
+	KUNIT_EXPECT_EQ(test, piadagio_fp_geometry_init(&tmp_geo, 4, 21, NULL), -EINVAL);	// More than the screen buffer
+	KUNIT_EXPECT_EQ(test, piadagio_fp_geometry_init(&tmp_geo, 1, 41, NULL), -EINVAL);	// More than a half
+	KUNIT_EXPECT_EQ(test, piadagio_fp_geometry_init(&tmp_geo, 4, 20, tmp_repeated), -EINVAL);
+}
+
+static void piadagio_fp_test_screen_diff(struct kunit *test) {
+	struct piadagio_fp_geometry tmp_geo;
+	struct piadagio_fp_char_buffer tmp_screen, tmp_new;
+
+	piadagio_fp_geometry_init(&tmp_geo, 4, 20, NULL);
+	piadagio_fp_test_fill_rows(&tmp_geo, &tmp_screen);
+	memcpy(&tmp_new, &tmp_screen, sizeof(tmp_new));
+	KUNIT_EXPECT_EQ(test, piadagio_fp_screen_diff(&tmp_geo, &tmp_screen, (unsigned char *) tmp_new.chars), (u8) 0);
+
+	tmp_new.chars[(2 * 20) + 5] = 'x';					// Line 3 is in the first half
+	KUNIT_EXPECT_EQ(test, piadagio_fp_screen_diff(&tmp_geo, &tmp_screen, (unsigned char *) tmp_new.chars), (u8) PIADAGIOFP_SCREEN_HALF_1);
+	tmp_new.chars[(3 * 20) + 19] = 'x';					// Line 4 is in the second
+	KUNIT_EXPECT_EQ(test, piadagio_fp_screen_diff(&tmp_geo, &tmp_screen, (unsigned char *) tmp_new.chars), (u8) PIADAGIOFP_SCREEN_HALVES);
+
+	// Characters past the panel's rows are ignored
+	piadagio_fp_geometry_init(&tmp_geo, 2, 16, NULL);
+	memcpy(&tmp_new, &tmp_screen, sizeof(tmp_new));
+	tmp_new.chars[40] = 'x';
+	KUNIT_EXPECT_EQ(test, piadagio_fp_screen_diff(&tmp_geo, &tmp_screen, (unsigned char *) tmp_new.chars), (u8) 0);
+}
+
+static void piadagio_fp_test_splash_render(struct kunit *test) {
+	struct piadagio_fp_geometry tmp_geo;
+	struct piadagio_fp_char_buffer tmp_screen;
+
+	piadagio_fp_geometry_init(&tmp_geo, 2, 16, NULL);
+	piadagio_fp_splash_render(&tmp_geo, &tmp_screen, "ab|cd|ef");
+	KUNIT_EXPECT_EQ(test, memcmp(tmp_screen.chars, "ab              cd              ", 32), 0);
+	KUNIT_EXPECT_TRUE(test, piadagio_fp_test_all(&tmp_screen.chars[32], ' ', SCREEN_BUFFER_LEN - 32));
+}
+
+////////////////////////////////////////////////////////////////////
+// Canvas
+////////////////////////////////////////////////////////////////////
+static void piadagio_fp_test_canvas_project(struct kunit *test) {
+	struct piadagio_fp_geometry tmp_geo;
+	struct piadagio_fp_char_buffer tmp_screen;
+	char *tmp_canvas;
+	unsigned int i;
+
+	tmp_canvas = kunit_kzalloc(test, CANVAS_BUFFER_LEN, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, tmp_canvas);
+
+	// Canvas lines are the panel's width
+	piadagio_fp_geometry_init(&tmp_geo, 4, 20, NULL);
+	KUNIT_EXPECT_EQ(test, piadagio_fp_canvas_viewport_max(&tmp_geo), 252U);
+	piadagio_fp_geometry_init(&tmp_geo, 2, 16, NULL);
+	KUNIT_EXPECT_EQ(test, piadagio_fp_canvas_viewport_max(&tmp_geo), 318U);
+	piadagio_fp_geometry_init(&tmp_geo, 2, 40, NULL);
+	KUNIT_EXPECT_EQ(test, piadagio_fp_canvas_viewport_max(&tmp_geo), 126U);
+
+	piadagio_fp_geometry_init(&tmp_geo, 4, 20, NULL);
+	for (i = 0; i < (CANVAS_BUFFER_LEN / 20); i++) {
+		memset(&tmp_canvas[i * 20], 'a' + (i % 26), 20);
+	}
+	memset(tmp_screen.chars, ' ', SCREEN_BUFFER_LEN);
+
+	KUNIT_EXPECT_EQ(test, piadagio_fp_canvas_project(&tmp_geo, &tmp_screen, tmp_canvas, 1), (u8) PIADAGIOFP_SCREEN_HALVES);
+	KUNIT_EXPECT_EQ(test, memcmp(tmp_screen.chars, &tmp_canvas[20], 80), 0);
+	KUNIT_EXPECT_EQ(test, piadagio_fp_canvas_project(&tmp_geo, &tmp_screen, tmp_canvas, 1), (u8) 0);
+
+	// Scrolling by 26 lines shows the same characters
+	KUNIT_EXPECT_EQ(test, piadagio_fp_canvas_project(&tmp_geo, &tmp_screen, tmp_canvas, 27), (u8) 0);
+
+	// The last viewport shows the end of the canvas
+	piadagio_fp_canvas_project(&tmp_geo, &tmp_screen, tmp_canvas, piadagio_fp_canvas_viewport_max(&tmp_geo));
+	KUNIT_EXPECT_EQ(test, memcmp(tmp_screen.chars, &tmp_canvas[CANVAS_BUFFER_LEN - 80], 80), 0);
+}
+
+////////////////////////////////////////////////////////////////////
+// Packet encoding and shadow
+////////////////////////////////////////////////////////////////////
+static void piadagio_fp_test_encode_screen(struct kunit *test) {
+	struct piadagio_fp_geometry tmp_geo;
+	struct piadagio_fp_char_buffer tmp_screen;
+	unsigned char tmp_msg[I2C_MSG_LEN_UPDATE_LCD];
+
+	// 20x4, lines 1 & 3, then 2 & 4
+	piadagio_fp_geometry_init(&tmp_geo, 4, 20, NULL);
+	piadagio_fp_test_fill_rows(&tmp_geo, &tmp_screen);
+	KUNIT_EXPECT_EQ(test, piadagio_fp_encode_screen(&tmp_geo, tmp_msg, &tmp_screen, false), (unsigned int) I2C_MSG_LEN_UPDATE_LCD);
+	KUNIT_EXPECT_EQ(test, tmp_msg[0], (unsigned char) (I2C_MSG_LEN_UPDATE_LCD - 1));
+	KUNIT_EXPECT_EQ(test, tmp_msg[1], (unsigned char) I2C_MSG_TYPE_CHAR);
+	KUNIT_EXPECT_EQ(test, tmp_msg[2], (unsigned char) 0);
+	KUNIT_EXPECT_TRUE(test, piadagio_fp_test_all(&tmp_msg[3], 'A', 20));
+	KUNIT_EXPECT_TRUE(test, piadagio_fp_test_all(&tmp_msg[23], 'C', 20));
+	piadagio_fp_encode_screen(&tmp_geo, tmp_msg, &tmp_screen, true);
+	KUNIT_EXPECT_EQ(test, tmp_msg[2], (unsigned char) 1);
+	KUNIT_EXPECT_TRUE(test, piadagio_fp_test_all(&tmp_msg[3], 'B', 20));
+	KUNIT_EXPECT_TRUE(test, piadagio_fp_test_all(&tmp_msg[23], 'D', 20));
+
+	// A NUL on the screen is sent as is
+	tmp_screen.chars[5] = 0;
+	piadagio_fp_encode_screen(&tmp_geo, tmp_msg, &tmp_screen, false);
+	KUNIT_EXPECT_EQ(test, tmp_msg[3 + 5], (unsigned char) 0);
+	KUNIT_EXPECT_TRUE(test, piadagio_fp_test_all(&tmp_msg[23], 'C', 20));
+
+	// 16x2, a row per half padded with spaces
+	piadagio_fp_geometry_init(&tmp_geo, 2, 16, NULL);
+	piadagio_fp_test_fill_rows(&tmp_geo, &tmp_screen);
+	piadagio_fp_encode_screen(&tmp_geo, tmp_msg, &tmp_screen, true);
+	KUNIT_EXPECT_TRUE(test, piadagio_fp_test_all(&tmp_msg[3], 'B', 16));
+	KUNIT_EXPECT_TRUE(test, piadagio_fp_test_all(&tmp_msg[19], ' ', 24));
+
+	// 40x2, a row fills a half
+	piadagio_fp_geometry_init(&tmp_geo, 2, 40, NULL);
+	piadagio_fp_test_fill_rows(&tmp_geo, &tmp_screen);
+	piadagio_fp_encode_screen(&tmp_geo, tmp_msg, &tmp_screen, false);
+	KUNIT_EXPECT_TRUE(test, piadagio_fp_test_all(&tmp_msg[3], 'A', 40));
+}
+
+static void piadagio_fp_test_encode_other(struct kunit *test) {
+	struct piadagio_fp_glyph tmp_glyph = { .pixel_line = { 1, 2, 3, 4, 5, 6, 7, 8 } };
+	unsigned char tmp_msg[I2C_MSG_LEN_UPDATE_LCD];
+
+	KUNIT_EXPECT_EQ(test, piadagio_fp_encode_glyph(tmp_msg, 5, &tmp_glyph), (unsigned int) I2C_MSG_LEN_UPDATE_CGRAM);
+	KUNIT_EXPECT_EQ(test, tmp_msg[0], (unsigned char) (I2C_MSG_LEN_UPDATE_CGRAM - 1));
+	KUNIT_EXPECT_EQ(test, tmp_msg[1], (unsigned char) I2C_MSG_TYPE_GLYPH);
+	KUNIT_EXPECT_EQ(test, tmp_msg[2], (unsigned char) 5);
+	KUNIT_EXPECT_EQ(test, memcmp(&tmp_msg[3], tmp_glyph.pixel_line, 8), 0);
+
+	KUNIT_EXPECT_EQ(test, piadagio_fp_encode_leds(tmp_msg, 0, 0), (unsigned int) I2C_MSG_LEN_UPDATE_LED);
+	KUNIT_EXPECT_EQ(test, tmp_msg[0], (unsigned char) (I2C_MSG_LEN_UPDATE_LED - 1));
+	KUNIT_EXPECT_EQ(test, tmp_msg[1], (unsigned char) I2C_MSG_TYPE_LED);
+	KUNIT_EXPECT_EQ(test, tmp_msg[2], (unsigned char) 0);
+	piadagio_fp_encode_leds(tmp_msg, 1, 0);
+	KUNIT_EXPECT_EQ(test, tmp_msg[2], (unsigned char) 2);
+	piadagio_fp_encode_leds(tmp_msg, 0, 3);
+	KUNIT_EXPECT_EQ(test, tmp_msg[2], (unsigned char) 1);
+
+	KUNIT_EXPECT_EQ(test, piadagio_fp_encode_clear(tmp_msg), (unsigned int) I2C_MSG_LEN_CLEAR);
+	KUNIT_EXPECT_EQ(test, tmp_msg[0], (unsigned char) (I2C_MSG_LEN_CLEAR - 1));
+	KUNIT_EXPECT_EQ(test, tmp_msg[1], (unsigned char) I2C_MSG_TYPE_CLEAR);
+}
+
+static void piadagio_fp_test_shadow(struct kunit *test) {
+	struct piadagio_fp_geometry tmp_geo;
+	struct piadagio_fp_char_buffer tmp_screen;
+	struct piadagio_fp_shadow tmp_shadow;
+	unsigned char tmp_msg[I2C_MSG_LEN_UPDATE_LCD];
+
+	memset(&tmp_shadow, 0, sizeof(tmp_shadow));
+	piadagio_fp_geometry_init(&tmp_geo, 4, 20, NULL);
+	piadagio_fp_test_fill_rows(&tmp_geo, &tmp_screen);
+
+	// Nothing is known about the panel to start with
+	KUNIT_EXPECT_EQ(test, piadagio_fp_shadow_screen_diff(&tmp_geo, &tmp_shadow, &tmp_screen), (u8) PIADAGIOFP_SCREEN_HALVES);
+
+	piadagio_fp_encode_screen(&tmp_geo, tmp_msg, &tmp_screen, false);
+	KUNIT_EXPECT_EQ(test, piadagio_fp_shadow_store_screen(&tmp_geo, &tmp_shadow, tmp_msg), (u8) PIADAGIOFP_SCREEN_HALF_1);
+	KUNIT_EXPECT_EQ(test, piadagio_fp_shadow_screen_diff(&tmp_geo, &tmp_shadow, &tmp_screen), (u8) PIADAGIOFP_SCREEN_HALF_2);
+	piadagio_fp_encode_screen(&tmp_geo, tmp_msg, &tmp_screen, true);
+	KUNIT_EXPECT_EQ(test, piadagio_fp_shadow_store_screen(&tmp_geo, &tmp_shadow, tmp_msg), (u8) PIADAGIOFP_SCREEN_HALF_2);
+	KUNIT_EXPECT_EQ(test, piadagio_fp_shadow_screen_diff(&tmp_geo, &tmp_shadow, &tmp_screen), (u8) 0);
+	KUNIT_EXPECT_EQ(test, memcmp(tmp_shadow.screen.chars, tmp_screen.chars, 80), 0);
+
+	tmp_screen.chars[20] = 'x';						// Line 2 is in the second half
+	KUNIT_EXPECT_EQ(test, piadagio_fp_shadow_screen_diff(&tmp_geo, &tmp_shadow, &tmp_screen), (u8) PIADAGIOFP_SCREEN_HALF_2);
+
+	// LEDs
+	KUNIT_EXPECT_FALSE(test, piadagio_fp_shadow_leds_current(&tmp_shadow, 1, 1));
+	tmp_shadow.leds = 3;
+	tmp_shadow.leds_valid = true;
+	KUNIT_EXPECT_TRUE(test, piadagio_fp_shadow_leds_current(&tmp_shadow, 1, 1));
+	KUNIT_EXPECT_FALSE(test, piadagio_fp_shadow_leds_current(&tmp_shadow, 0, 1));
+
+	// Glyphs
+	tmp_shadow.cgram.glyph[2].pixel_line[0] = 0x1f;
+	KUNIT_EXPECT_FALSE(test, piadagio_fp_shadow_glyph_current(&tmp_shadow, 2, &tmp_shadow.cgram.glyph[2]));
+	tmp_shadow.cgram_valid = (1 << 2);
+	KUNIT_EXPECT_TRUE(test, piadagio_fp_shadow_glyph_current(&tmp_shadow, 2, &tmp_shadow.cgram.glyph[2]));
+	KUNIT_EXPECT_FALSE(test, piadagio_fp_shadow_glyph_current(&tmp_shadow, 2, &tmp_shadow.cgram.glyph[3]));
+}
+
+static void piadagio_fp_test_glyph_update(struct kunit *test) {
+	struct piadagio_fp_glyphs tmp_glyphs;
+	bool tmp_updated[8] = { false };
+	unsigned char tmp_image[GLYPH_BUFFER_LEN];
+
+	memset(&tmp_glyphs, 0, sizeof(tmp_glyphs));
+	memset(tmp_image, 0, sizeof(tmp_image));
+	KUNIT_EXPECT_FALSE(test, piadagio_fp_glyph_update(&tmp_glyphs, tmp_updated, tmp_image));
+
+	tmp_image[(3 * 8) + 7] = 0x1f;
+	KUNIT_EXPECT_TRUE(test, piadagio_fp_glyph_update(&tmp_glyphs, tmp_updated, tmp_image));
+	KUNIT_EXPECT_TRUE(test, tmp_updated[3]);
+	KUNIT_EXPECT_FALSE(test, tmp_updated[2]);
+	KUNIT_EXPECT_EQ(test, tmp_glyphs.glyph[3].pixel_line[7], (unsigned char) 0x1f);
+}
+
+static void piadagio_fp_test_bank_name_valid(struct kunit *test) {
+	KUNIT_EXPECT_TRUE(test, piadagio_fp_bank_name_valid("default"));
+	KUNIT_EXPECT_TRUE(test, piadagio_fp_bank_name_valid("big-digits_2"));
+	KUNIT_EXPECT_TRUE(test, piadagio_fp_bank_name_valid("0123456789012345678901234567890"));
+
+	// Anything that could leave the firmware directory, or isn't a name
+	KUNIT_EXPECT_FALSE(test, piadagio_fp_bank_name_valid(""));
+	KUNIT_EXPECT_FALSE(test, piadagio_fp_bank_name_valid("../default"));
+	KUNIT_EXPECT_FALSE(test, piadagio_fp_bank_name_valid("sub/default"));
+	KUNIT_EXPECT_FALSE(test, piadagio_fp_bank_name_valid("default.bin"));
+	KUNIT_EXPECT_FALSE(test, piadagio_fp_bank_name_valid("default\n"));
+	KUNIT_EXPECT_FALSE(test, piadagio_fp_bank_name_valid("01234567890123456789012345678901"));	// Too long
+}
+
+////////////////////////////////////////////////////////////////////
+// Buttons
+////////////////////////////////////////////////////////////////////
+static void piadagio_fp_test_button_step(struct kunit *test) {
+	struct piadagio_fp_button tmp_button = {
+		.state		= PIADAGIOFP_BUTTON_IDLE,
+		.debounce	= 20,
+		.long_press	= 1000,
+		.repeat		= 200,
+	};
+	u16 tmp_code = 0;
+	u32 tmp_value = 0;
+
+	// A bounce shorter than the debounce time is ignored
+	KUNIT_EXPECT_EQ(test, piadagio_fp_button_step(&tmp_button, 5, 0, &tmp_code, &tmp_value), (u16) 0);
+	KUNIT_EXPECT_EQ(test, tmp_button.state, (unsigned int) PIADAGIOFP_BUTTON_DEBOUNCE);
+	KUNIT_EXPECT_EQ(test, piadagio_fp_button_step(&tmp_button, 0, 5, &tmp_code, &tmp_value), (u16) 0);
+	KUNIT_EXPECT_EQ(test, tmp_button.state, (unsigned int) PIADAGIOFP_BUTTON_IDLE);
+	KUNIT_EXPECT_EQ(test, piadagio_fp_button_next(&tmp_button, 5, PIADAGIOFP_BUTTON_POLL), (s64) -1);
+
+	// Press, long press, repeat, then release
+	KUNIT_EXPECT_EQ(test, piadagio_fp_button_step(&tmp_button, 5, 100, &tmp_code, &tmp_value), (u16) 0);
+	KUNIT_EXPECT_EQ(test, piadagio_fp_button_next(&tmp_button, 110, PIADAGIOFP_BUTTON_POLL), (s64) 10);
+	KUNIT_EXPECT_EQ(test, piadagio_fp_button_step(&tmp_button, 5, 120, &tmp_code, &tmp_value), (u16) PIADAGIOFP_EVENT_PRESS);
+	KUNIT_EXPECT_EQ(test, tmp_code, (u16) 5);
+	KUNIT_EXPECT_EQ(test, piadagio_fp_button_next(&tmp_button, 120, PIADAGIOFP_BUTTON_POLL), (s64) PIADAGIOFP_BUTTON_POLL);
+	KUNIT_EXPECT_EQ(test, piadagio_fp_button_step(&tmp_button, 5, 1119, &tmp_code, &tmp_value), (u16) 0);
+	KUNIT_EXPECT_EQ(test, piadagio_fp_button_step(&tmp_button, 5, 1120, &tmp_code, &tmp_value), (u16) PIADAGIOFP_EVENT_LONG_PRESS);
+	KUNIT_EXPECT_EQ(test, tmp_value, 1000U);
+	KUNIT_EXPECT_EQ(test, piadagio_fp_button_step(&tmp_button, 5, 1320, &tmp_code, &tmp_value), (u16) PIADAGIOFP_EVENT_REPEAT);
+	KUNIT_EXPECT_EQ(test, tmp_value, 1U);
+
+	// A repeat that's fallen behind doesn't burst
+	KUNIT_EXPECT_EQ(test, piadagio_fp_button_step(&tmp_button, 5, 2000, &tmp_code, &tmp_value), (u16) PIADAGIOFP_EVENT_REPEAT);
+	KUNIT_EXPECT_EQ(test, tmp_value, 2U);
+	KUNIT_EXPECT_EQ(test, piadagio_fp_button_step(&tmp_button, 5, 2010, &tmp_code, &tmp_value), (u16) 0);
+
+	KUNIT_EXPECT_EQ(test, piadagio_fp_button_step(&tmp_button, 0, 2100, &tmp_code, &tmp_value), (u16) 0);
+	KUNIT_EXPECT_EQ(test, piadagio_fp_button_step(&tmp_button, 0, 2120, &tmp_code, &tmp_value), (u16) PIADAGIOFP_EVENT_RELEASE);
+	KUNIT_EXPECT_EQ(test, tmp_code, (u16) 5);
+	KUNIT_EXPECT_EQ(test, tmp_value, 1980U);				// Held from the press, until first seen released
+	KUNIT_EXPECT_EQ(test, tmp_button.state, (unsigned int) PIADAGIOFP_BUTTON_IDLE);
+
+	// Without a debounce time, a press is reported straight away
+	tmp_button.debounce = 0;
+	KUNIT_EXPECT_EQ(test, piadagio_fp_button_step(&tmp_button, 7, 3000, &tmp_code, &tmp_value), (u16) PIADAGIOFP_EVENT_PRESS);
+	KUNIT_EXPECT_EQ(test, tmp_code, (u16) 7);
+}
+
+////////////////////////////////////////////////////////////////////
+// Big text
+////////////////////////////////////////////////////////////////////
+static void piadagio_fp_test_big_text(struct kunit *test) {
+	static const unsigned char tmp_zero[2][3] = { { BIG_LT, BIG_UB, BIG_RT }, { BIG_LL, BIG_LB, BIG_LR } };
+	char tmp_top[LCD_LINE_LEN], tmp_bottom[LCD_LINE_LEN];
+
+	// Digits, '-' and ' ' are 4 columns, ':' and '.' are 2
+	KUNIT_EXPECT_EQ(test, piadagio_fp_big_width("12:34", 5), 18);
+	KUNIT_EXPECT_EQ(test, piadagio_fp_big_width("-1.5", 4), 14);
+	KUNIT_EXPECT_EQ(test, piadagio_fp_big_width("12:34", 2), 8);		// Stops at len
+	KUNIT_EXPECT_EQ(test, piadagio_fp_big_width("12", 12), 8);		// or the null
+	KUNIT_EXPECT_EQ(test, piadagio_fp_big_width("1a", 2), -1);
+
+	memset(tmp_top, ' ', LCD_LINE_LEN);
+	memset(tmp_bottom, ' ', LCD_LINE_LEN);
+	piadagio_fp_big_render(tmp_top, tmp_bottom, "1:0", 3);
+	KUNIT_EXPECT_EQ(test, (unsigned char) tmp_top[0], (unsigned char) BIG_UB);
+	KUNIT_EXPECT_EQ(test, (unsigned char) tmp_bottom[1], (unsigned char) BIG_FB);
+	KUNIT_EXPECT_EQ(test, tmp_top[3], (char) ' ');
+	KUNIT_EXPECT_EQ(test, (unsigned char) tmp_top[4], (unsigned char) BIG_DOT);
+	KUNIT_EXPECT_EQ(test, (unsigned char) tmp_bottom[4], (unsigned char) BIG_DOT);
+	KUNIT_EXPECT_EQ(test, memcmp(&tmp_top[6], tmp_zero[0], 3), 0);
+	KUNIT_EXPECT_EQ(test, memcmp(&tmp_bottom[6], tmp_zero[1], 3), 0);
+	KUNIT_EXPECT_TRUE(test, piadagio_fp_test_all((unsigned char *) &tmp_top[9], ' ', LCD_LINE_LEN - 9));
+
+	// The glyphs are drawn through their upper alias, so never a 0
+	KUNIT_EXPECT_TRUE(test, memchr(tmp_top, 0, LCD_LINE_LEN) == NULL);
+	KUNIT_EXPECT_TRUE(test, memchr(tmp_bottom, 0, LCD_LINE_LEN) == NULL);
+}
+
+////////////////////////////////////////////////////////////////////
+// Text mode
+////////////////////////////////////////////////////////////////////
+static void piadagio_fp_test_text_feed(struct kunit *test) {
+	struct piadagio_fp_geometry tmp_geo;
+	struct piadagio_fp_text tmp_text;
+	struct piadagio_fp_char_buffer tmp_screen;
+	struct piadagio_fp_glyphs tmp_glyphs;
+	bool tmp_updated[8] = { false };
+	static const unsigned char tmp_glyph[8] = { 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x1f };
+
+	piadagio_fp_geometry_init(&tmp_geo, 4, 20, NULL);
+	memset(&tmp_text, 0, sizeof(tmp_text));
+	memset(&tmp_glyphs, 0, sizeof(tmp_glyphs));
+	memset(tmp_screen.chars, '.', SCREEN_BUFFER_LEN);
+
+	// Characters are written at the cursor, past the end of the line is dropped
+	KUNIT_EXPECT_EQ(test, piadagio_fp_test_text(&tmp_geo, &tmp_text, &tmp_screen, &tmp_glyphs, tmp_updated, "Hi"), (u8) PIADAGIOFP_TEXT_CHANGED);
+	KUNIT_EXPECT_EQ(test, memcmp(tmp_screen.chars, "Hi.", 3), 0);
+	piadagio_fp_test_text(&tmp_geo, &tmp_text, &tmp_screen, &tmp_glyphs, tmp_updated, "0123456789012345678901234");
+	KUNIT_EXPECT_EQ(test, tmp_text.col, (u8) 20);
+	KUNIT_EXPECT_EQ(test, tmp_screen.chars[20], (char) '.');
+
+	// Newline clears the rest of the line, and wraps at the last row
+	piadagio_fp_test_text(&tmp_geo, &tmp_text, &tmp_screen, &tmp_glyphs, tmp_updated, "\nab\n");
+	KUNIT_EXPECT_EQ(test, memcmp(&tmp_screen.chars[20], "ab ", 3), 0);
+	KUNIT_EXPECT_TRUE(test, piadagio_fp_test_all((unsigned char *) &tmp_screen.chars[22], ' ', 18));
+	KUNIT_EXPECT_EQ(test, tmp_text.row, (u8) 2);
+	piadagio_fp_test_text(&tmp_geo, &tmp_text, &tmp_screen, &tmp_glyphs, tmp_updated, "\n\n");
+	KUNIT_EXPECT_EQ(test, tmp_text.row, (u8) 0);
+
+	// Cursor movement, backspace and carriage return
+	piadagio_fp_test_text(&tmp_geo, &tmp_text, &tmp_screen, &tmp_glyphs, tmp_updated, "\x1b[3;5HXY\bZ\rW");
+	KUNIT_EXPECT_EQ(test, memcmp(&tmp_screen.chars[(2 * 20) + 4], "XZ", 2), 0);
+	KUNIT_EXPECT_EQ(test, tmp_screen.chars[2 * 20], (char) 'W');
+	piadagio_fp_test_text(&tmp_geo, &tmp_text, &tmp_screen, &tmp_glyphs, tmp_updated, "\x1b[9;99H");
+	KUNIT_EXPECT_EQ(test, tmp_text.row, (u8) 3);				// Clamped to the panel
+	KUNIT_EXPECT_EQ(test, tmp_text.col, (u8) 19);
+
+	// Glyphs 0-7 are written as their upper alias
+	piadagio_fp_test_text(&tmp_geo, &tmp_text, &tmp_screen, &tmp_glyphs, tmp_updated, "\x1b[H\x03");
+	KUNIT_EXPECT_EQ(test, tmp_screen.chars[0], (char) 0xb);
+
+	// Line and screen clears
+	piadagio_fp_test_text(&tmp_geo, &tmp_text, &tmp_screen, &tmp_glyphs, tmp_updated, "\x1b[2K");
+	KUNIT_EXPECT_TRUE(test, piadagio_fp_test_all((unsigned char *) tmp_screen.chars, ' ', 20));
+	KUNIT_EXPECT_EQ(test, piadagio_fp_test_text(&tmp_geo, &tmp_text, &tmp_screen, &tmp_glyphs, tmp_updated, "\x1b[2J"), (u8) PIADAGIOFP_TEXT_CHANGED);
+	KUNIT_EXPECT_TRUE(test, piadagio_fp_test_all((unsigned char *) tmp_screen.chars, ' ', SCREEN_BUFFER_LEN));
+
+	// Form feed commits
+	KUNIT_EXPECT_EQ(test, piadagio_fp_test_text(&tmp_geo, &tmp_text, &tmp_screen, &tmp_glyphs, tmp_updated, "\f"), (u8) PIADAGIOFP_TEXT_COMMIT);
+
+	// Glyph definition, only flagged when it changes
+	KUNIT_EXPECT_EQ(test, piadagio_fp_test_text(&tmp_geo, &tmp_text, &tmp_screen, &tmp_glyphs, tmp_updated, "\x1b[LG2010203040506071f;"), (u8) 0);
+	KUNIT_EXPECT_TRUE(test, tmp_updated[2]);
+	KUNIT_EXPECT_EQ(test, memcmp(tmp_glyphs.glyph[2].pixel_line, tmp_glyph, 8), 0);
+	tmp_updated[2] = false;
+	piadagio_fp_test_text(&tmp_geo, &tmp_text, &tmp_screen, &tmp_glyphs, tmp_updated, "\x1b[LG2010203040506071f;");
+	KUNIT_EXPECT_FALSE(test, tmp_updated[2]);
+
+	// A malformed glyph is dropped, and the parser recovers
+	piadagio_fp_test_text(&tmp_geo, &tmp_text, &tmp_screen, &tmp_glyphs, tmp_updated, "\x1b[LG3zz;");
+	KUNIT_EXPECT_FALSE(test, tmp_updated[3]);
+	KUNIT_EXPECT_EQ(test, tmp_text.state, (u8) PIADAGIOFP_TEXT_NORMAL);
+}
+
+////////////////////////////////////////////////////////////////////
+// Microbenchmarks
+// Not pass/fail, the results are reported for comparing changes.
+////////////////////////////////////////////////////////////////////
+// Write path throughput, copying writes into the screen buffer as
+// piadagio_fp_write does (less the copy from userspace).
+static void piadagio_fp_test_bench_write(struct kunit *test) {
+	struct piadagio_fp_char_buffer *tmp_screen;
+	char *tmp_data;
+	unsigned int tmp_index = 0;
+	int tmp_buffer;
+	size_t tmp_written = 0, tmp_count, tmp_chunk, tmp_pos;
+	u64 tmp_start, tmp_ns;
+
+	tmp_screen = kunit_kzalloc(test, sizeof(*tmp_screen), GFP_KERNEL);
+	tmp_data = kunit_kzalloc(test, PIADAGIOFP_BENCH_WRITE_CHUNK, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, tmp_screen);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, tmp_data);
+	memset(tmp_data, 'x', PIADAGIOFP_BENCH_WRITE_CHUNK);
+
+	tmp_start = ktime_get_ns();
+	while (tmp_written < PIADAGIOFP_BENCH_WRITE_LEN) {
+		tmp_buffer = piadagio_fp_offset_decode(0, &tmp_index);
+		KUNIT_ASSERT_EQ(test, tmp_buffer, BUFFER_WRITE_CHAR);
+		for (tmp_count = PIADAGIOFP_BENCH_WRITE_CHUNK, tmp_pos = 0; tmp_count; ) {
+			tmp_chunk = piadagio_fp_buffer_chunk(tmp_index, tmp_count, SCREEN_BUFFER_LEN);
+			memcpy(&tmp_screen->chars[tmp_index], &tmp_data[tmp_pos], tmp_chunk);
+			tmp_pos += tmp_chunk;
+			tmp_count -= tmp_chunk;
+			tmp_index = piadagio_fp_buffer_advance(tmp_index, tmp_chunk, SCREEN_BUFFER_LEN);
+		}
+		tmp_written += PIADAGIOFP_BENCH_WRITE_CHUNK;
+	}
+	tmp_ns = max_t(u64, 1, ktime_get_ns() - tmp_start);
+
+	KUNIT_EXPECT_EQ(test, tmp_screen->chars[SCREEN_BUFFER_LEN - 1], (char) 'x');
+	kunit_info(test, "write path: %u bytes in %u byte writes, %llu ns (%llu MB/s)\n",
+				PIADAGIOFP_BENCH_WRITE_LEN, PIADAGIOFP_BENCH_WRITE_CHUNK, tmp_ns,
+				div64_u64((u64) PIADAGIOFP_BENCH_WRITE_LEN * 1000, tmp_ns));
+}
+
+// Per frame encoding cost, for each of the common geometries and a
+// custom one: the shadow diff, encoding both halves, and recording them
+// in the shadow (as the LCD task does for each frame).
+static void piadagio_fp_test_bench_frame(struct kunit *test) {
+	static const unsigned int tmp_sizes[][2] = { { 4, 20 }, { 2, 16 }, { 2, 40 }, { 3, 20 } };
+	struct piadagio_fp_geometry tmp_geo;
+	struct piadagio_fp_char_buffer tmp_screen;
+	struct piadagio_fp_shadow *tmp_shadow;
+	unsigned char tmp_msg[I2C_MSG_LEN_UPDATE_LCD];
+	unsigned int i, j, tmp_sent;
+	u64 tmp_start, tmp_ns;
+	u8 tmp_halves;
+
+	tmp_shadow = kunit_kzalloc(test, sizeof(*tmp_shadow), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, tmp_shadow);
+
+	for (i = 0; i < ARRAY_SIZE(tmp_sizes); i++) {
+		KUNIT_ASSERT_EQ(test, piadagio_fp_geometry_init(&tmp_geo, tmp_sizes[i][0], tmp_sizes[i][1], NULL), 0);
+		piadagio_fp_test_fill_rows(&tmp_geo, &tmp_screen);
+		memset(tmp_shadow, 0, sizeof(*tmp_shadow));
+		tmp_sent = 0;
+
+		tmp_start = ktime_get_ns();
+		for (j = 0; j < PIADAGIOFP_BENCH_FRAMES; j++) {
+			tmp_screen.chars[j % (tmp_geo.rows * tmp_geo.cols)]++;	// Change one half each frame
+			tmp_halves = piadagio_fp_shadow_screen_diff(&tmp_geo, tmp_shadow, &tmp_screen);
+			if (tmp_halves & PIADAGIOFP_SCREEN_HALF_1) {
+				tmp_sent += piadagio_fp_encode_screen(&tmp_geo, tmp_msg, &tmp_screen, false);
+				piadagio_fp_shadow_store_screen(&tmp_geo, tmp_shadow, tmp_msg);
+			}
+			if (tmp_halves & PIADAGIOFP_SCREEN_HALF_2) {
+				tmp_sent += piadagio_fp_encode_screen(&tmp_geo, tmp_msg, &tmp_screen, true);
+				piadagio_fp_shadow_store_screen(&tmp_geo, tmp_shadow, tmp_msg);
+			}
+		}
+		tmp_ns = ktime_get_ns() - tmp_start;
+
+		KUNIT_EXPECT_EQ(test, piadagio_fp_shadow_screen_diff(&tmp_geo, tmp_shadow, &tmp_screen), (u8) 0);
+		kunit_info(test, "frame encode %ux%u (%s): %llu ns/frame, %u bytes/frame\n",
+				tmp_geo.cols, tmp_geo.rows,
+				(tmp_geo.kind == PIADAGIOFP_GEOMETRY_CUSTOM) ? "custom" : "fast path",
+				div64_u64(tmp_ns, PIADAGIOFP_BENCH_FRAMES), tmp_sent / PIADAGIOFP_BENCH_FRAMES);
+	}
+}
+
+// Text mode parser throughput
+static void piadagio_fp_test_bench_text(struct kunit *test) {
+	static const char tmp_line[] = "\x1b[2;1HVolume: 42 dB\x1b[K\n";
+	struct piadagio_fp_geometry tmp_geo;
+	struct piadagio_fp_text tmp_text;
+	struct piadagio_fp_char_buffer tmp_screen;
+	struct piadagio_fp_glyphs tmp_glyphs;
+	bool tmp_updated[8] = { false };
+	unsigned int i;
+	u64 tmp_start, tmp_ns;
+
+	piadagio_fp_geometry_init(&tmp_geo, 4, 20, NULL);
+	memset(&tmp_text, 0, sizeof(tmp_text));
+	memset(&tmp_glyphs, 0, sizeof(tmp_glyphs));
+
+	tmp_start = ktime_get_ns();
+	for (i = 0; i < PIADAGIOFP_BENCH_FRAMES; i++) {
+		piadagio_fp_test_text(&tmp_geo, &tmp_text, &tmp_screen, &tmp_glyphs, tmp_updated, tmp_line);
+	}
+	tmp_ns = max_t(u64, 1, ktime_get_ns() - tmp_start);
+
+	KUNIT_EXPECT_EQ(test, memcmp(&tmp_screen.chars[20], "Volume: 42 dB", 13), 0);
+	kunit_info(test, "text feed: %llu ns/line, %llu chars/ms\n",
+				div64_u64(tmp_ns, PIADAGIOFP_BENCH_FRAMES),
+				div64_u64((u64) PIADAGIOFP_BENCH_FRAMES * (sizeof(tmp_line) - 1) * 1000000, tmp_ns));
+}
+
+static struct kunit_case piadagio_fp_test_cases[] = {
+	KUNIT_CASE(piadagio_fp_test_offset_decode),
+	KUNIT_CASE(piadagio_fp_test_buffer_wrap),
+	KUNIT_CASE(piadagio_fp_test_glyph_mark_range),
+	KUNIT_CASE(piadagio_fp_test_geometry_init),
+	KUNIT_CASE(piadagio_fp_test_screen_diff),
+	KUNIT_CASE(piadagio_fp_test_splash_render),
+	KUNIT_CASE(piadagio_fp_test_canvas_project),
+	KUNIT_CASE(piadagio_fp_test_encode_screen),
+	KUNIT_CASE(piadagio_fp_test_encode_other),
+	KUNIT_CASE(piadagio_fp_test_shadow),
+	KUNIT_CASE(piadagio_fp_test_glyph_update),
+	KUNIT_CASE(piadagio_fp_test_bank_name_valid),
+	KUNIT_CASE(piadagio_fp_test_button_step),
+	KUNIT_CASE(piadagio_fp_test_big_text),
+	KUNIT_CASE(piadagio_fp_test_text_feed),
+	KUNIT_CASE(piadagio_fp_test_bench_write),
+	KUNIT_CASE(piadagio_fp_test_bench_frame),
+	KUNIT_CASE(piadagio_fp_test_bench_text),
+	{}
+};
+
+static struct kunit_suite piadagio_fp_test_suite = {
+	.name = "piadagio_fp",
+	.test_cases = piadagio_fp_test_cases,
+};
+kunit_test_suite(piadagio_fp_test_suite);
+
+MODULE_DESCRIPTION("Adagio front panel driver unit tests");
+MODULE_LICENSE("GPL");